@@ -6,6 +6,8 @@
 
 #pragma once
 
+#include <stdint.h>
+
 #include "span.h"
 
 namespace my
@@ -58,5 +60,55 @@ void sort(Span<T> arr, Lambda less)
     heapify(arr, i, 0, less);
   }
 }
+
+// Stable LSD radix sort, one byte per pass.
+// Stores into 'order' the indices of 'keys', by increasing key.
+// 'tmp' is scratch storage, of the same size as 'order'.
+// Passes where all the keys have the same byte are skipped.
+inline void radixSort(Span<const uint64_t> keys, Span<int> order, Span<int> tmp)
+{
+  auto const n = keys.len;
+
+  int counts[8][256] {};
+
+  for(int i = 0; i < n; ++i)
+    for(int pass = 0; pass < 8; ++pass)
+      counts[pass][(keys[i] >> (pass * 8)) & 0xff]++;
+
+  auto src = order;
+  auto dst = tmp;
+
+  for(int i = 0; i < n; ++i)
+    src[i] = i;
+
+  for(int pass = 0; pass < 8; ++pass)
+  {
+    auto& count = counts[pass];
+
+    if(n == 0 || count[(keys[0] >> (pass * 8)) & 0xff] == n)
+      continue;
+
+    int offset = 0;
+
+    for(auto& c : count)
+    {
+      auto const bucketSize = c;
+      c = offset;
+      offset += bucketSize;
+    }
+
+    for(int i = 0; i < n; ++i)
+    {
+      auto const idx = src[i];
+      dst[count[(keys[idx] >> (pass * 8)) & 0xff]++] = idx;
+    }
+
+    swap(src, dst);
+  }
+
+  if(src.data != order.data)
+    for(int i = 0; i < n; ++i)
+      order[i] = src[i];
+}
 }
 
@@ -50,7 +50,18 @@ struct View
   virtual void setCameraPos(Vector2f pos) = 0;
   virtual void setAmbientLight(float amount) = 0;
 
+  // reports a performance counter (for debugging purposes)
+  virtual void setStat(char const* name, float value) = 0;
+
   // adds a displayable object to the current frame
   virtual void sendActor(Actor const& actor) = 0;
+
+  // Static tile layer, uploaded once (e.g when entering a room).
+  // 'tiles' holds the action of 'model' to display in each unit cell,
+  // or -1 for empty cells.
+  virtual void setTileLayer(MODEL model, Matrix2<int> const& tiles) = 0;
+
+  // adds the tile layer to the current frame
+  virtual void sendTileLayer(int zOrder) = 0;
 };
 
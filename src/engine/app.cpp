@@ -10,6 +10,8 @@
 
 #include "app.h"
 
+#include <algorithm> // clamp, max
+#include <cmath> // abs
 #include <memory>
 #include <string>
 #include <vector>
@@ -24,7 +26,9 @@
 #include "audio.h"
 #include "audio_backend.h"
 #include "display.h"
+#include "frame_writer.h"
 #include "input.h"
+#include "interpolation.h"
 #include "ratecounter.h"
 #include "stats.h"
 
@@ -33,9 +37,10 @@ using namespace std;
 auto const TIMESTEP = 10;
 auto const RESOLUTION = Size2i(512, 512);
 
-Display* createDisplay(Size2i resolution);
+Display* createDisplay(Size2i resolution, bool headless);
+Display* createThreadedDisplay(Display* display);
 MixableAudio* createAudio();
-UserInput* createUserInput();
+UserInput* createUserInput(bool headless);
 
 Scene* createGame(View* view, vector<string> argv);
 
@@ -45,12 +50,34 @@ public:
   App(Span<char*> args)
     : m_args({ args.data, args.data + args.len })
   {
-    m_display.reset(createDisplay(RESOLUTION));
+    bool headless = false;
+    bool renderThread = false;
+
+    for(int i = (int)m_args.size() - 1; i >= 0; --i)
+    {
+      if(m_args[i] == "--headless")
+      {
+        headless = true;
+        m_args.erase(m_args.begin() + i);
+      }
+      else if(m_args[i] == "--render-thread")
+      {
+        renderThread = true;
+        m_args.erase(m_args.begin() + i);
+      }
+    }
+
+    m_display.reset(createDisplay(RESOLUTION, headless));
+
+    // draw from another thread, so the gameplay never waits for vsync
+    if(renderThread)
+      m_display.reset(createThreadedDisplay(m_display.release()));
     m_audio.reset(createAudio());
-    m_audioBackend.reset(createAudioBackend(m_audio.get()));
-    m_input.reset(createUserInput());
+    m_audioBackend.reset(createAudioBackend(m_audio.get(), headless));
+    m_input.reset(createUserInput(headless));
 
     m_scene.reset(createGame(this, m_args));
+    takeSnapshot();
 
     m_lastTime = GetSteadyClockMs();
     m_lastDisplayFrameTime = GetSteadyClockMs();
@@ -85,19 +112,23 @@ private:
   void tickOneDisplayFrame(int now)
   {
     const auto timeStep = m_slowMotion ? TIMESTEP * 10 : TIMESTEP;
+    const auto tickCount = max(0, (now - m_lastTime - 1) / timeStep);
 
-    while(m_lastTime + timeStep < now)
+    for(int i = 0; i < tickCount; ++i)
     {
       m_lastTime += timeStep;
 
       if(!m_paused && m_running == 1)
         tickGameplay();
+
+      // only the two last snapshots are drawn
+      if(i >= tickCount - 2)
+        takeSnapshot();
     }
 
-    // draw the frame
-    m_actors.clear();
-    m_scene->draw();
-    draw();
+    // draw the frame, between the two last ticks
+    auto const alpha = clamp((now - m_lastTime) / float(timeStep), 0.0f, 1.0f);
+    draw(alpha);
 
     m_fps.tick(now);
     Stat("FPS", m_fps.slope());
@@ -107,21 +138,23 @@ private:
 
   void captureDisplayFrameIfNeeded()
   {
-    if(m_captureFile || m_mustScreenshot)
+    if(m_frameWriter)
+    {
+      if(m_display->readPixelsDelayed(m_capturePixels))
+        m_frameWriter->push(m_capturePixels);
+
+      Stat("Dropped frames", m_frameWriter->droppedFrames());
+    }
+
+    if(m_mustScreenshot)
     {
       vector<uint8_t> pixels(RESOLUTION.width * RESOLUTION.height * 4);
       m_display->readPixels({ pixels.data(), (int)pixels.size() });
 
-      if(m_captureFile)
-        fwrite(pixels.data(), 1, pixels.size(), m_captureFile);
-
-      if(m_mustScreenshot)
-      {
-        File::write("screenshot.rgba", pixels);
-        fprintf(stderr, "Saved screenshot to 'screenshot.rgba'\n");
+      File::write("screenshot.rgba", pixels);
+      fprintf(stderr, "Saved screenshot to 'screenshot.rgba'\n");
 
-        m_mustScreenshot = false;
-      }
+      m_mustScreenshot = false;
     }
   }
 
@@ -172,8 +205,22 @@ private:
     m_input->listenToKey(Key::Pause, [&] (bool isDown) { if(isDown){ playSound(0); m_paused = !m_paused; } });
   }
 
-  void draw()
+  // asks the scene for its actors, as of the last tick
+  void takeSnapshot()
   {
+    swap(m_prevSnapshot, m_currSnapshot);
+
+    m_currSnapshot.actors.clear();
+    m_currSnapshot.tileLayers.clear();
+    m_scene->draw();
+    m_currSnapshot.cameraPos = m_cameraPos;
+  }
+
+  void draw(float alpha)
+  {
+    m_interpolator.interpolate(m_prevSnapshot.actors, m_currSnapshot.actors, alpha, m_actors);
+    m_display->setCamera(interpolate(m_prevSnapshot.cameraPos, m_currSnapshot.cameraPos, alpha));
+
     m_display->beginDraw();
 
     for(auto& actor : m_actors)
@@ -182,6 +229,9 @@ private:
       m_display->drawActor(where, actor.angle, !actor.screenRefFrame, (int)actor.model, actor.effect == Effect::Blinking, actor.action, actor.ratio, actor.zOrder);
     }
 
+    for(auto zOrder : m_currSnapshot.tileLayers)
+      m_display->drawTileLayer(zOrder);
+
     if(m_running == 2)
       m_display->drawText(Vector2f(0, 0), "QUIT? [Y/N]");
     else if(m_paused)
@@ -241,12 +291,21 @@ private:
         return;
       }
 
+      m_capturePixels.resize(RESOLUTION.width * RESOLUTION.height * 4);
+      m_frameWriter = make_unique<FrameWriter>(m_captureFile, RESOLUTION, 8);
+
       m_fixedDisplayFramePeriod = 40;
       fprintf(stderr, "Capturing video at %d Hz...\n", 1000 / m_fixedDisplayFramePeriod);
     }
     else
     {
       fprintf(stderr, "Stopped video capture\n");
+
+      // the last frames are still being read back
+      while(m_display->flushReadback(m_capturePixels))
+        m_frameWriter->push(m_capturePixels);
+
+      m_frameWriter.reset(); // writes the pending frames
       fclose(m_captureFile);
       m_captureFile = nullptr;
       m_fixedDisplayFramePeriod = 0;
@@ -329,9 +388,17 @@ private:
     m_audio->releaseVoice(voiceId, true);
   }
 
+  // called once per tick
   void setCameraPos(Vector2f pos) override
   {
-    m_display->setCamera(pos);
+    auto const delta = pos - m_cameraPos;
+
+    // smooth camera moves, except for big jumps
+    if(!m_cameraValid || abs(delta.x) > 2 || abs(delta.y) > 2)
+      m_cameraPos = pos;
+
+    m_cameraPos = m_cameraPos * 0.7f + pos * 0.3f;
+    m_cameraValid = true;
   }
 
   void setAmbientLight(float amount) override
@@ -339,14 +406,31 @@ private:
     m_display->setAmbientLight(amount);
   }
 
+  void setStat(char const* name, float value) override
+  {
+    Stat(name, value);
+  }
+
   void sendActor(Actor const& actor) override
   {
-    m_actors.push_back(actor);
+    m_currSnapshot.actors.push_back(actor);
+  }
+
+  void setTileLayer(MODEL model, Matrix2<int> const& tiles) override
+  {
+    m_display->setTileLayer((int)model, tiles);
+  }
+
+  void sendTileLayer(int zOrder) override
+  {
+    m_currSnapshot.tileLayers.push_back(zOrder);
   }
 
   int m_running = 1;
   int m_fixedDisplayFramePeriod = 0;
   FILE* m_captureFile = nullptr;
+  unique_ptr<FrameWriter> m_frameWriter;
+  vector<uint8_t> m_capturePixels;
   bool m_mustScreenshot = false;
 
   bool m_debugMode = false;
@@ -363,7 +447,22 @@ private:
   unique_ptr<MixableAudio> m_audio;
   unique_ptr<IAudioBackend> m_audioBackend;
   unique_ptr<Display> m_display;
-  vector<Actor> m_actors;
+
+  // what the scene sent during a tick
+  struct Snapshot
+  {
+    vector<Actor> actors;
+    vector<int> tileLayers;
+    Vector2f cameraPos = Vector2f(0, 0);
+  };
+
+  Snapshot m_prevSnapshot;
+  Snapshot m_currSnapshot;
+  ActorInterpolator m_interpolator;
+  vector<Actor> m_actors; // current frame, interpolated
+
+  Vector2f m_cameraPos = Vector2f(0, 0); // smoothed
+  bool m_cameraValid = false;
   unique_ptr<UserInput> m_input;
 
   string m_textbox;
@@ -17,5 +17,6 @@ struct IAudioBackend
 
 struct IAudioMixer;
 
-IAudioBackend* createAudioBackend(IAudioMixer* mixer);
+// 'headless': no audio device is opened, the mixer is never pulled
+IAudioBackend* createAudioBackend(IAudioMixer* mixer, bool headless);
 
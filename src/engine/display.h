@@ -23,8 +23,28 @@ struct Display
   virtual void endDraw() = 0;
   virtual void drawActor(Rect2f where, float angle, bool useWorldRefFrame, int modelId, bool blinking, int actionIdx, float frame, int zOrder) = 0;
   virtual void drawText(Vector2f pos, char const* text) = 0;
+
+  // static tiles, kept across frames, in world coordinates
+  virtual void setTileLayer(int modelId, Matrix2<int> const& tiles) = 0;
+  virtual void drawTileLayer(int zOrder) = 0;
+
   virtual void setCamera(Vector2f pos) = 0;
   virtual void setAmbientLight(float ambientLight) = 0;
   virtual void readPixels(Span<uint8_t> dstRgbPixels) = 0;
+
+  // Non-blocking version of 'readPixels', for video capture: starts
+  // reading the last frame back, and returns a frame started a few calls
+  // ago. Rows are bottom-up. Returns false while no frame is ready yet.
+  virtual bool readPixelsDelayed(Span<uint8_t> dstRgbPixels) = 0;
+
+  // Returns the frames started by 'readPixelsDelayed' and not returned
+  // yet, oldest first, one per call. Returns false when none is left.
+  virtual bool flushReadback(Span<uint8_t> dstRgbPixels) = 0;
+
+  // Rendering from another thread than the one that created the display:
+  // 'detachThread' is called from the thread that stops rendering, then
+  // 'attachThread' from the thread that starts.
+  virtual void detachThread() = 0;
+  virtual void attachThread() = 0;
 };
 
@@ -0,0 +1,115 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+#include "frame_writer.h"
+
+#include <cstring> // memcpy
+
+#include "base/error.h"
+
+using namespace std;
+
+FrameWriter::FrameWriter(FILE* file, Size2i resolution, int maxPendingFrames)
+  : m_file(file)
+  , m_resolution(resolution)
+{
+  auto const frameSize = resolution.width * resolution.height * 4;
+
+  // all the memory is allocated upfront
+  m_slots.resize(maxPendingFrames);
+
+  for(int i = 0; i < maxPendingFrames; ++i)
+  {
+    m_slots[i].resize(frameSize);
+    m_freeSlots.push_back(i);
+  }
+
+  m_pendingSlots.reserve(maxPendingFrames);
+
+  m_thread = thread([this] () { writerMain(); });
+}
+
+FrameWriter::~FrameWriter()
+{
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_quit = true;
+  }
+
+  m_wakeUp.notify_one();
+  m_thread.join();
+}
+
+bool FrameWriter::push(Span<const uint8_t> pixels)
+{
+  if(pixels.len != m_resolution.width * m_resolution.height * 4)
+    throw Error("FrameWriter: invalid frame size");
+
+  int slot;
+
+  {
+    lock_guard<mutex> lock(m_mutex);
+
+    if(m_freeSlots.empty())
+    {
+      ++m_droppedFrames;
+      return false;
+    }
+
+    slot = m_freeSlots.back();
+    m_freeSlots.pop_back();
+  }
+
+  // the slot now belongs to us: copy outside of the lock
+  auto& frame = m_slots[slot];
+  memcpy(frame.data(), pixels.data, frame.size());
+
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_pendingSlots.push_back(slot);
+  }
+
+  m_wakeUp.notify_one();
+  return true;
+}
+
+int FrameWriter::droppedFrames() const
+{
+  lock_guard<mutex> lock(m_mutex);
+  return m_droppedFrames;
+}
+
+void FrameWriter::writerMain()
+{
+  auto const rowSize = m_resolution.width * 4;
+
+  while(true)
+  {
+    int slot;
+
+    {
+      unique_lock<mutex> lock(m_mutex);
+      m_wakeUp.wait(lock, [&] () { return m_quit || !m_pendingSlots.empty(); });
+
+      // when quitting, the pending frames are still written
+      if(m_pendingSlots.empty())
+        return;
+
+      slot = m_pendingSlots.front();
+      m_pendingSlots.erase(m_pendingSlots.begin());
+    }
+
+    auto const& frame = m_slots[slot];
+
+    for(int row = m_resolution.height - 1; row >= 0; --row)
+      fwrite(frame.data() + row * rowSize, 1, rowSize, m_file);
+
+    {
+      lock_guard<mutex> lock(m_mutex);
+      m_freeSlots.push_back(slot);
+    }
+  }
+}
@@ -0,0 +1,54 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+// Writes raw video frames to a file, from a background thread.
+// The caller never waits for the disk: when all the slots are in use,
+// the new frame is dropped.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio> // FILE
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "base/geom.h"
+#include "base/span.h"
+
+struct FrameWriter
+{
+  // 'file' stays owned by the caller, and must outlive the writer.
+  FrameWriter(FILE* file, Size2i resolution, int maxPendingFrames);
+
+  // writes the pending frames, then stops the thread
+  ~FrameWriter();
+
+  // 'pixels' is RGBA, with bottom-up rows (as returned by OpenGL):
+  // rows are flipped when written.
+  // Returns false if the frame was dropped.
+  bool push(Span<const uint8_t> pixels);
+
+  int droppedFrames() const;
+
+private:
+  void writerMain();
+
+  FILE* const m_file;
+  Size2i const m_resolution;
+
+  std::vector<std::vector<uint8_t>> m_slots;
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_wakeUp;
+  std::vector<int> m_freeSlots;
+  std::vector<int> m_pendingSlots; // FIFO, oldest first
+  int m_droppedFrames = 0;
+  bool m_quit = false;
+
+  std::thread m_thread;
+};
@@ -0,0 +1,74 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+#include "interpolation.h"
+
+#include <algorithm> // max
+#include <cmath> // abs
+
+using namespace std;
+
+Vector2f interpolate(Vector2f prev, Vector2f curr, float alpha)
+{
+  auto const delta = curr - prev;
+
+  if(abs(delta.x) > MAX_INTERPOLATED_MOVE || abs(delta.y) > MAX_INTERPOLATED_MOVE)
+    return curr;
+
+  return prev + delta * alpha;
+}
+
+void ActorInterpolator::interpolate(vector<Actor> const& prev, vector<Actor> const& curr, float alpha, vector<Actor>& result)
+{
+  int modelCount = 0;
+
+  for(auto& actor : prev)
+    modelCount = max(modelCount, actor.model + 1);
+
+  // group the indices of 'prev' by model, keeping their order (counting sort)
+  m_firstPrev.assign(modelCount + 1, 0);
+
+  for(auto& actor : prev)
+    if(actor.model >= 0)
+      ++m_firstPrev[actor.model + 1];
+
+  for(int model = 0; model < modelCount; ++model)
+    m_firstPrev[model + 1] += m_firstPrev[model];
+
+  m_rank.assign(modelCount, 0);
+  m_prevByModel.resize(prev.size());
+
+  for(int i = 0; i < (int)prev.size(); ++i)
+  {
+    auto const model = prev[i].model;
+
+    if(model >= 0)
+      m_prevByModel[m_firstPrev[model] + m_rank[model]++] = i;
+  }
+
+  m_rank.assign(modelCount, 0);
+  result = curr;
+
+  for(auto& actor : result)
+  {
+    auto const model = actor.model;
+
+    if(model < 0 || model >= modelCount)
+      continue;
+
+    auto const entry = m_firstPrev[model] + m_rank[model]++;
+
+    if(entry >= m_firstPrev[model + 1])
+      continue;
+
+    auto const& old = prev[m_prevByModel[entry]];
+
+    if(old.screenRefFrame != actor.screenRefFrame)
+      continue;
+
+    actor.pos = ::interpolate(old.pos, actor.pos, alpha);
+  }
+}
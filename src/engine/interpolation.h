@@ -0,0 +1,39 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+// Display of a fixed timestep simulation: the frames are drawn between
+// the two last simulation states, so the motion looks smooth whatever
+// the display refresh rate.
+
+#pragma once
+
+#include <vector>
+
+#include "base/geom.h"
+#include "base/view.h" // Actor
+
+// Beyond this distance, a move is a jump (e.g a teleport, or a room
+// transition) and isn't interpolated.
+auto const MAX_INTERPOLATED_MOVE = 2.0f;
+
+// 'alpha' is in [0 .. 1], 0 meaning 'prev'
+Vector2f interpolate(Vector2f prev, Vector2f curr, float alpha);
+
+struct ActorInterpolator
+{
+  // Computes 'result' from 'curr', with the positions interpolated from 'prev'.
+  // Actors have no identity: the n-th actor of a model in 'curr' is matched
+  // with the n-th actor of the same model in 'prev'. The unmatched actors
+  // are drawn at their current position.
+  void interpolate(std::vector<Actor> const& prev, std::vector<Actor> const& curr, float alpha, std::vector<Actor>& result);
+
+private:
+  // Indexed by model, the models being small resource indices.
+  // Only resized, so their memory is reused from one frame to the next.
+  std::vector<int> m_firstPrev; // model -> first entry of 'm_prevByModel'
+  std::vector<int> m_rank; // model -> actors of this model seen so far
+  std::vector<int> m_prevByModel; // indices into 'prev', grouped by model
+};
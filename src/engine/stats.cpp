@@ -1,16 +1,21 @@
 #include "stats.h"
 #include <map>
+#include <mutex>
 #include <string>
 #include <vector>
 
 namespace
 {
+// stats are also reported by the render thread
+std::mutex g_Mutex;
 std::vector<StatVal> g_Values;
 std::map<const char*, int> g_Map;
 }
 
 void Stat(const char* name, float value)
 {
+  std::lock_guard<std::mutex> lock(g_Mutex);
+
   auto i = g_Map.find(name);
 
   if(i == g_Map.end())
@@ -25,11 +30,13 @@ void Stat(const char* name, float value)
 
 int getStatCount()
 {
+  std::lock_guard<std::mutex> lock(g_Mutex);
   return (int)g_Values.size();
 }
 
 StatVal getStat(int idx)
 {
+  std::lock_guard<std::mutex> lock(g_Mutex);
   return g_Values.at(idx);
 }
 
@@ -0,0 +1,402 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+// Runs a display on its own thread.
+// The draw calls of a frame are recorded, then replayed by the render
+// thread, while the caller goes on with the next frame. The caller never
+// waits for the render thread (e.g for vsync): when the render thread is
+// late, the frame it didn't start yet is replaced by the newer one.
+
+#include <atomic>
+#include <condition_variable>
+#include <exception> // exception_ptr
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "display.h"
+#include "stats.h"
+
+using namespace std;
+
+namespace
+{
+// everything needed to draw one frame
+struct Frame
+{
+  struct Command
+  {
+    enum Type
+    {
+      DrawActor,
+      DrawText,
+      DrawTileLayer,
+    };
+
+    Type type;
+    Rect2f where; // DrawActor, or DrawText ('where.pos')
+    float angle;
+    bool useWorldRefFrame;
+    int modelId;
+    bool blinking;
+    int actionIdx;
+    float ratio;
+    int zOrder; // DrawActor, DrawTileLayer
+    int text; // DrawText: offset into 'text'
+  };
+
+  // state, as of the end of the frame
+  bool cameraValid = false;
+  Vector2f camera = Vector2f(0, 0);
+  float ambientLight = 0;
+
+  vector<Command> commands;
+  vector<char> text; // zero-terminated strings
+
+  void clear()
+  {
+    commands.clear();
+    text.clear();
+  }
+};
+
+struct ThreadedDisplay : Display
+{
+  ThreadedDisplay(Display* display) : m_display(display)
+  {
+    m_display->detachThread();
+    m_thread = thread([this] () { renderMain(); });
+  }
+
+  // draws the pending frame, then stops the thread
+  ~ThreadedDisplay()
+  {
+    {
+      lock_guard<mutex> lock(m_mutex);
+      m_quit = true;
+    }
+
+    m_wakeUp.notify_one();
+    m_thread.join();
+
+    m_display->attachThread();
+  }
+
+  // window management stays on the calling thread
+  void setFullscreen(bool fs) override
+  {
+    m_display->setFullscreen(fs);
+  }
+
+  void setCaption(const char* caption) override
+  {
+    m_display->setCaption(caption);
+  }
+
+  void loadModel(int id, String path) override
+  {
+    auto pathString = string(path.data, path.len);
+    post([this, id, pathString] () { m_display->loadModel(id, pathString); });
+  }
+
+  void setTileLayer(int modelId, Matrix2<int> const& tiles) override
+  {
+    auto const size = tiles.size;
+    vector<int> cells;
+    cells.reserve(size.width * size.height);
+
+    for(int y = 0; y < size.height; ++y)
+      for(int x = 0; x < size.width; ++x)
+        cells.push_back(tiles.get(x, y));
+
+    auto task =
+      [this, modelId, size, cells] ()
+      {
+        Matrix2<int> copy(size);
+
+        for(int y = 0; y < size.height; ++y)
+          for(int x = 0; x < size.width; ++x)
+            copy.set(x, y, cells[x + y * size.width]);
+
+        m_display->setTileLayer(modelId, copy);
+      };
+
+    post(task);
+  }
+
+  void setCamera(Vector2f pos) override
+  {
+    m_camera = pos;
+    m_cameraValid = true;
+  }
+
+  void setAmbientLight(float ambientLight) override
+  {
+    m_ambientLight = ambientLight;
+  }
+
+  void beginDraw() override
+  {
+    rethrowRenderError();
+  }
+
+  void drawActor(Rect2f where, float angle, bool useWorldRefFrame, int modelId, bool blinking, int actionIdx, float ratio, int zOrder) override
+  {
+    Frame::Command cmd {};
+    cmd.type = Frame::Command::DrawActor;
+    cmd.where = where;
+    cmd.angle = angle;
+    cmd.useWorldRefFrame = useWorldRefFrame;
+    cmd.modelId = modelId;
+    cmd.blinking = blinking;
+    cmd.actionIdx = actionIdx;
+    cmd.ratio = ratio;
+    cmd.zOrder = zOrder;
+    backFrame().commands.push_back(cmd);
+  }
+
+  void drawText(Vector2f pos, char const* text) override
+  {
+    auto& frame = backFrame();
+
+    Frame::Command cmd {};
+    cmd.type = Frame::Command::DrawText;
+    cmd.where.pos = pos;
+    cmd.text = (int)frame.text.size();
+    frame.commands.push_back(cmd);
+
+    for(auto c = text; *c; ++c)
+      frame.text.push_back(*c);
+
+    frame.text.push_back(0);
+  }
+
+  void drawTileLayer(int zOrder) override
+  {
+    Frame::Command cmd {};
+    cmd.type = Frame::Command::DrawTileLayer;
+    cmd.zOrder = zOrder;
+    backFrame().commands.push_back(cmd);
+  }
+
+  // publishes the frame: never waits for the render thread
+  void endDraw() override
+  {
+    auto& frame = backFrame();
+    frame.cameraValid = m_cameraValid;
+    frame.camera = m_camera;
+    frame.ambientLight = m_ambientLight;
+
+    auto const prev = m_pendingFrame.exchange(m_backFrame | NEW_FRAME);
+
+    if(prev & NEW_FRAME)
+      ++m_droppedFrames;
+
+    m_backFrame = prev & ~NEW_FRAME;
+    backFrame().clear();
+
+    // the lock only prevents the wake-up from being lost
+    {
+      lock_guard<mutex> lock(m_mutex);
+    }
+
+    m_wakeUp.notify_one();
+
+    Stat("Dropped render frames", m_droppedFrames);
+  }
+
+  // These wait for the render thread.
+  // The pixels are the ones of a frame drawn before the call.
+  void readPixels(Span<uint8_t> dstRgbPixels) override
+  {
+    runAndWait([&] () { m_display->readPixels(dstRgbPixels); });
+  }
+
+  bool readPixelsDelayed(Span<uint8_t> dstRgbPixels) override
+  {
+    bool ready = false;
+    runAndWait([&] () { ready = m_display->readPixelsDelayed(dstRgbPixels); });
+    return ready;
+  }
+
+  bool flushReadback(Span<uint8_t> dstRgbPixels) override
+  {
+    bool ready = false;
+    runAndWait([&] () { ready = m_display->flushReadback(dstRgbPixels); });
+    return ready;
+  }
+
+  // the render thread is attached once and for all
+  void detachThread() override {}
+  void attachThread() override {}
+
+private:
+  Frame& backFrame()
+  {
+    return m_frames[m_backFrame];
+  }
+
+  // queues a task for the render thread: tasks are run before drawing
+  // the frames published after them.
+  void post(function<void()> task)
+  {
+    {
+      lock_guard<mutex> lock(m_mutex);
+      m_tasks.push_back(move(task));
+    }
+
+    m_wakeUp.notify_one();
+  }
+
+  void runAndWait(function<void()> task)
+  {
+    bool done = false;
+
+    auto wrapper =
+      [&] ()
+      {
+        task();
+
+        lock_guard<mutex> lock(m_mutex);
+        done = true;
+        m_taskDone.notify_all();
+      };
+
+    post(wrapper);
+
+    {
+      unique_lock<mutex> lock(m_mutex);
+      m_taskDone.wait(lock, [&] () { return done || m_renderError; });
+    }
+
+    rethrowRenderError();
+  }
+
+  // errors of the render thread are reported to the caller
+  void rethrowRenderError()
+  {
+    lock_guard<mutex> lock(m_mutex);
+
+    if(m_renderError)
+      rethrow_exception(m_renderError);
+  }
+
+  void renderMain()
+  {
+    try
+    {
+      m_display->attachThread();
+
+      vector<function<void()>> tasks;
+
+      while(true)
+      {
+        bool quit;
+
+        {
+          unique_lock<mutex> lock(m_mutex);
+          m_wakeUp.wait(lock, [&] () { return m_quit || !m_tasks.empty() || (m_pendingFrame & NEW_FRAME); });
+          quit = m_quit;
+        }
+
+        // take the frame before the tasks: the tasks it depends on
+        // were posted before it was published.
+        auto const hasFrame = (m_pendingFrame & NEW_FRAME) != 0;
+
+        if(hasFrame)
+          m_frontFrame = m_pendingFrame.exchange(m_frontFrame) & ~NEW_FRAME;
+
+        {
+          lock_guard<mutex> lock(m_mutex);
+          swap(tasks, m_tasks);
+        }
+
+        for(auto& task : tasks)
+          task();
+
+        tasks.clear();
+
+        if(hasFrame)
+          drawFrame(m_frames[m_frontFrame]);
+
+        if(quit)
+          break;
+      }
+
+      m_display->detachThread();
+    }
+    catch(...)
+    {
+      lock_guard<mutex> lock(m_mutex);
+      m_renderError = current_exception();
+      m_taskDone.notify_all();
+    }
+  }
+
+  void drawFrame(Frame const& frame)
+  {
+    if(frame.cameraValid)
+      m_display->setCamera(frame.camera);
+
+    m_display->setAmbientLight(frame.ambientLight);
+
+    m_display->beginDraw();
+
+    for(auto& cmd : frame.commands)
+    {
+      switch(cmd.type)
+      {
+      case Frame::Command::DrawActor:
+        m_display->drawActor(cmd.where, cmd.angle, cmd.useWorldRefFrame, cmd.modelId, cmd.blinking, cmd.actionIdx, cmd.ratio, cmd.zOrder);
+        break;
+      case Frame::Command::DrawText:
+        m_display->drawText(cmd.where.pos, &frame.text[cmd.text]);
+        break;
+      case Frame::Command::DrawTileLayer:
+        m_display->drawTileLayer(cmd.zOrder);
+        break;
+      }
+    }
+
+    m_display->endDraw();
+  }
+
+  unique_ptr<Display> const m_display;
+
+  // Triple buffering: the caller records into the back frame, the render
+  // thread draws the front frame. Published frames are exchanged through
+  // 'm_pendingFrame', without locking.
+  static auto const NEW_FRAME = 4; // flag: the pending frame wasn't drawn yet
+  Frame m_frames[3];
+  int m_backFrame = 0; // caller only
+  int m_frontFrame = 1; // render thread only
+  atomic<int> m_pendingFrame { 2 };
+  int m_droppedFrames = 0;
+
+  // caller state
+  bool m_cameraValid = false;
+  Vector2f m_camera = Vector2f(0, 0);
+  float m_ambientLight = 0;
+
+  // protected by 'm_mutex'
+  mutex m_mutex;
+  condition_variable m_wakeUp;
+  condition_variable m_taskDone;
+  vector<function<void()>> m_tasks; // FIFO
+  exception_ptr m_renderError;
+  bool m_quit = false;
+
+  thread m_thread;
+};
+}
+
+Display* createThreadedDisplay(Display* display)
+{
+  return new ThreadedDisplay(display);
+}
@@ -19,7 +19,9 @@ struct FragileBlock : Entity, Damageable
   FragileBlock()
   {
     size = UnitSize;
-    reappear();
+    collisionGroup = CG_WALLS;
+    collidesWith = CG_WALLS;
+    solid = 1;
   }
 
   virtual void addActors(vector<Actor>& actors) const override
@@ -56,9 +58,9 @@ struct FragileBlock : Entity, Damageable
     {
       if(decrement(timer))
       {
-        collisionGroup = 0;
-        collidesWith = 0;
-        solid = 0;
+        physics->setCollisionGroup(this, 0);
+        physics->setSolid(this, false);
+        physics->setCollidesWith(this, 0);
 
         state = 2;
         timer = 300;
@@ -80,9 +82,9 @@ struct FragileBlock : Entity, Damageable
 
   void reappear()
   {
-    collisionGroup = CG_WALLS;
-    collidesWith = CG_WALLS;
-    solid = 1;
+    physics->setCollisionGroup(this, CG_WALLS);
+    physics->setSolid(this, true);
+    physics->setCollidesWith(this, CG_WALLS);
     state = 0;
   }
 
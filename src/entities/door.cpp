@@ -30,7 +30,7 @@ struct Door : Entity
 
         // in case of closing, immediately prevent traversal
         if(!open)
-          solid = true;
+          physics->setSolid(this, true);
 
         game->playSound(SND_DOOR);
       };
@@ -42,7 +42,7 @@ struct Door : Entity
     state = var->get();
 
     if(state)
-      solid = false;
+      physics->setSolid(this, false);
   }
 
   void leave() override
@@ -55,7 +55,7 @@ struct Door : Entity
     decrement(delay);
 
     if(delay == 0 && state)
-      solid = false;
+      physics->setSolid(this, false);
   }
 
   virtual void addActors(vector<Actor>& actors) const override
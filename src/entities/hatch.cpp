@@ -51,15 +51,15 @@ struct Hatch : Entity
 
     if(openingTimer > 0)
     {
-      collidesWith = 0;
+      physics->setCollidesWith(this, 0);
 
       if(openingTimer < (OPEN_DURATION * 9) / 10)
-        solid = 0;
+        physics->setSolid(this, false);
     }
     else if(!physics->getBodiesInBox(getBox(), CG_PLAYER, false, this))
     {
-      collidesWith = CG_PLAYER;
-      solid = 1;
+      physics->setCollidesWith(this, CG_PLAYER);
+      physics->setSolid(this, true);
     }
   }
 
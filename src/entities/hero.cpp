@@ -271,7 +271,7 @@ struct Rockman : Player, Damageable
 
     if(ladder)
     {
-      pos.x = ladderX + 0.1;
+      physics->teleportBody(this, Vector(ladderX + 0.1, pos.y));
 
       if(c.jump || c.left || c.right)
       {
@@ -394,10 +394,14 @@ struct Rockman : Player, Damageable
     decrement(ladderDelay);
 
     handleBall();
-    collisionGroup = CG_PLAYER;
+
+    auto group = CG_PLAYER;
 
     if(!blinking)
-      collisionGroup |= CG_SOLIDPLAYER;
+      group |= CG_SOLIDPLAYER;
+
+    if(group != collisionGroup)
+      physics->setCollisionGroup(this, group);
   }
 
   virtual void onDamage(int amount) override
@@ -448,7 +452,7 @@ struct Rockman : Player, Damageable
   {
     game->playSound(SND_DIE);
     ball = false;
-    size = NORMAL_SIZE;
+    physics->resizeBody(this, NORMAL_SIZE);
     dieDelay = 150;
   }
 
@@ -465,7 +469,7 @@ struct Rockman : Player, Damageable
     if(!ladder && control.down && !ball && (upgrades & UPGRADE_BALL))
     {
       ball = true;
-      size = Size(NORMAL_SIZE.width, 0.9);
+      physics->resizeBody(this, Size(NORMAL_SIZE.width, 0.9));
     }
 
     if(control.up && ball)
@@ -477,7 +481,7 @@ struct Rockman : Player, Damageable
       if(!physics->isSolid(this, roundBox(box)))
       {
         ball = false;
-        size = NORMAL_SIZE;
+        physics->resizeBody(this, NORMAL_SIZE);
       }
     }
   }
@@ -38,7 +38,7 @@ struct SpiderBullet : Entity
 
   void tick() override
   {
-    pos += vel;
+    physics->teleportBody(this, pos + vel);
     decrement(life);
 
     if(life == 0)
@@ -35,10 +35,17 @@ struct Body
   // the body we rest on (if any)
   Body* floor = nullptr;
 
+  // fixed-point version of (pos, size), used for collision detection.
+  // Updated by the physics engine when it moves/resizes the body.
+  IntBox intBox;
+
+  // index in the physics engine body list (managed by the physics engine)
+  int physicsIndex = -1;
+
   // only called if (this->collidesWith & other->collisionGroup)
   function<void(Body*)> onCollision = [] (Body*) {};
 
   Box getFBox() const { return Box { pos, size }; }
-  IntBox getBox() const { return roundBox(getFBox()); }
+  IntBox getBox() const { return intBox; }
 };
 
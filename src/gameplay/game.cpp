@@ -27,6 +27,20 @@ Scene* createGame(View* view, vector<string> args)
   view->setTitle("Midniight");
   preloadResources(view);
 
+  // options
+  {
+    auto const PHYSICS_THREADS = string("--physics-threads=");
+
+    for(int i = (int)args.size() - 1; i >= 0; --i)
+    {
+      if(args[i].compare(0, PHYSICS_THREADS.size(), PHYSICS_THREADS) == 0)
+      {
+        setPhysicsThreadCount(atoi(args[i].c_str() + PHYSICS_THREADS.size()));
+        args.erase(args.begin() + i);
+      }
+    }
+  }
+
   if(args.size() == 1)
   {
     int level = atoi(args[0].c_str());
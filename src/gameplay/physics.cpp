@@ -6,9 +6,16 @@
  * License, or (at your option) any later version.
  */
 
-#include <cmath> // round
+#include <algorithm> // sort, unique, find
+#include <cassert>
+#include <cmath> // round, floor, sqrt
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
 
-#include "base/util.h"
 #include "body.h"
 #include "physics.h"
 #include <memory>
@@ -31,18 +38,433 @@ IntBox roundBox(Box b)
   return r;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Broadphase: bodies are registered in every cell of a uniform grid they
+// cover. The grid is folded into a fixed number of buckets, so rooms can be
+// arbitrarily large. Two overlapping bodies always share at least one cell.
+
+static auto const CELL_SIZE = 4 * PRECISION;
+static auto const BUCKET_COUNT = 1024; // must be a power of two
+
+// inclusive range of grid cells
+struct CellRange
+{
+  int x1, y1, x2, y2;
+
+  bool operator == (CellRange const& other) const
+  {
+    return x1 == other.x1 && y1 == other.y1 && x2 == other.x2 && y2 == other.y2;
+  }
+
+  bool operator != (CellRange const& other) const
+  {
+    return !(*this == other);
+  }
+};
+
+static
+bool operator == (IntBox const& a, IntBox const& b)
+{
+  return a.pos.x == b.pos.x && a.pos.y == b.pos.y && a.size.width == b.size.width && a.size.height == b.size.height;
+}
+
+static
+int toCell(int coord)
+{
+  // round towards minus infinity
+  if(coord >= 0)
+    return coord / CELL_SIZE;
+  else
+    return -((-coord + CELL_SIZE - 1) / CELL_SIZE);
+}
+
+static
+CellRange getCells(IntBox box)
+{
+  // a zero-sized box still overlaps the boxes containing its corner
+  CellRange r;
+  r.x1 = toCell(box.pos.x);
+  r.y1 = toCell(box.pos.y);
+  r.x2 = toCell(box.pos.x + max(box.size.width, 1) - 1);
+  r.y2 = toCell(box.pos.y + max(box.size.height, 1) - 1);
+  return r;
+}
+
+// Amanatides-Woo traversal: calls 'f(x, y, tEnter, tExit)' for each cell of
+// side 'cellSize' crossed by the segment 'from + t * delta', t in [0, 1],
+// in order, until 'f' returns false.
+template<typename Lambda>
+void traverseCells(Vector from, Vector delta, float cellSize, Lambda f)
+{
+  auto const INF = 1e30f;
+
+  int x = (int)floor(from.x / cellSize);
+  int y = (int)floor(from.y / cellSize);
+
+  int const stepX = delta.x > 0 ? 1 : -1;
+  int const stepY = delta.y > 0 ? 1 : -1;
+
+  auto const tDeltaX = delta.x != 0 ? cellSize / fabs(delta.x) : INF;
+  auto const tDeltaY = delta.y != 0 ? cellSize / fabs(delta.y) : INF;
+
+  auto tMaxX = delta.x != 0 ? ((x + (stepX > 0)) * cellSize - from.x) / delta.x : INF;
+  auto tMaxY = delta.y != 0 ? ((y + (stepY > 0)) * cellSize - from.y) / delta.y : INF;
+
+  float tEnter = 0;
+
+  while(true)
+  {
+    auto const tExit = min(min(tMaxX, tMaxY), 1.0f);
+
+    if(!f(x, y, tEnter, tExit))
+      return;
+
+    if(tExit >= 1)
+      return;
+
+    if(tMaxX < tMaxY)
+    {
+      x += stepX;
+      tMaxX += tDeltaX;
+    }
+    else
+    {
+      y += stepY;
+      tMaxY += tDeltaY;
+    }
+
+    tEnter = tExit;
+  }
+}
+
+// Slab test: returns the value of t where the segment 'from + t * delta'
+// enters 'box', or a negative value if it doesn't intersect it.
+static
+float intersectSegment(Vector from, Vector delta, IntBox box)
+{
+  float tEnter = 0;
+  float tExit = 1;
+
+  auto clip =
+    [&] (float origin, float dir, float min, float max)
+    {
+      if(dir == 0)
+        return origin >= min && origin <= max;
+
+      auto t1 = (min - origin) / dir;
+      auto t2 = (max - origin) / dir;
+
+      if(t1 > t2)
+        swap(t1, t2);
+
+      tEnter = std::max(tEnter, t1);
+      tExit = std::min(tExit, t2);
+      return tEnter <= tExit;
+    };
+
+  auto const x = box.pos.x / float(PRECISION);
+  auto const y = box.pos.y / float(PRECISION);
+  auto const w = box.size.width / float(PRECISION);
+  auto const h = box.size.height / float(PRECISION);
+
+  if(!clip(from.x, delta.x, x, x + w))
+    return -1;
+
+  if(!clip(from.y, delta.y, y, y + h))
+    return -1;
+
+  return tEnter;
+}
+
+struct SpatialHash
+{
+  void insert(Body* body, CellRange r)
+  {
+    for(int y = r.y1; y <= r.y2; ++y)
+      for(int x = r.x1; x <= r.x2; ++x)
+        m_buckets[hash(x, y)].push_back(body);
+  }
+
+  void remove(Body* body, CellRange r)
+  {
+    for(int y = r.y1; y <= r.y2; ++y)
+    {
+      for(int x = r.x1; x <= r.x2; ++x)
+      {
+        auto& bucket = m_buckets[hash(x, y)];
+
+        for(int i = 0; i < (int)bucket.size(); ++i)
+        {
+          if(bucket[i] == body)
+          {
+            bucket[i] = bucket.back();
+            bucket.pop_back();
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  // calls 'f' for each body registered in the bucket of the cell (x, y).
+  // The bucket might also contain bodies from other cells.
+  template<typename Lambda>
+  void visit(int x, int y, Lambda f) const
+  {
+    for(auto body : m_buckets[hash(x, y)])
+      f(body);
+  }
+
+  // calls 'f' for each body registered in the buckets covering 'r'.
+  // The same body might be reported several times.
+  template<typename Lambda>
+  void visit(CellRange r, Lambda f) const
+  {
+    for(int y = r.y1; y <= r.y2; ++y)
+      for(int x = r.x1; x <= r.x2; ++x)
+        for(auto body : m_buckets[hash(x, y)])
+          f(body);
+  }
+
+  // true if no body is registered in the buckets covering 'r'
+  bool isEmpty(CellRange r) const
+  {
+    for(int y = r.y1; y <= r.y2; ++y)
+      for(int x = r.x1; x <= r.x2; ++x)
+        if(!m_buckets[hash(x, y)].empty())
+          return false;
+
+    return true;
+  }
+
+private:
+  static int hash(int x, int y)
+  {
+    return ((unsigned)x * 73856093u ^ (unsigned)y * 19349663u) & (BUCKET_COUNT - 1);
+  }
+
+  vector<Body*> m_buckets[BUCKET_COUNT];
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Set of body indices, allowing to iterate over the members in index order.
+
+struct BodySet
+{
+  void set(int i, bool value)
+  {
+    auto const word = i / 64;
+    auto const mask = uint64_t(1) << (i % 64);
+
+    if(word >= (int)words.size())
+      words.resize(word + 1);
+
+    if(!!(words[word] & mask) == value)
+      return;
+
+    if(value)
+    {
+      words[word] |= mask;
+      ++count;
+    }
+    else
+    {
+      words[word] &= ~mask;
+      --count;
+    }
+  }
+
+  bool get(int i) const
+  {
+    auto const word = i / 64;
+
+    if(word >= (int)words.size())
+      return false;
+
+    return words[word] & (uint64_t(1) << (i % 64));
+  }
+
+  uint64_t word(int i) const
+  {
+    return i < (int)words.size() ? words[i] : 0;
+  }
+
+  void clear()
+  {
+    words.assign(words.size(), 0);
+    count = 0;
+  }
+
+  vector<uint64_t> words;
+  int count = 0;
+};
+
+// below this number of matching bodies, queries iterate over the matching
+// bodies instead of the grid cells.
+static auto const MAX_SPARSE_QUERY = 16;
+
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+// Persistent worker threads, running the same job in parallel.
+
+struct ThreadPool
+{
+  ThreadPool(int threadCount)
+  {
+    for(int i = 1; i < threadCount; ++i)
+      m_threads.emplace_back([this, i] () { workerMain(i); });
+  }
+
+  ~ThreadPool()
+  {
+    {
+      lock_guard<mutex> lock(m_mutex);
+      m_quit = true;
+    }
+
+    m_wakeUp.notify_all();
+
+    for(auto& t : m_threads)
+      t.join();
+  }
+
+  int size() const
+  {
+    return (int)m_threads.size() + 1;
+  }
+
+  // calls 'job(t)' for each t in [0, size()), and waits for completion.
+  // 'job(0)' runs on the calling thread.
+  void run(function<void(int)> job)
+  {
+    {
+      lock_guard<mutex> lock(m_mutex);
+      m_job = move(job);
+      m_pending = (int)m_threads.size();
+      ++m_generation;
+    }
+
+    m_wakeUp.notify_all();
+
+    m_job(0);
+
+    unique_lock<mutex> lock(m_mutex);
+    m_done.wait(lock, [&] () { return m_pending == 0; });
+  }
+
+private:
+  void workerMain(int index)
+  {
+    int generation = 0;
+
+    while(true)
+    {
+      {
+        unique_lock<mutex> lock(m_mutex);
+        m_wakeUp.wait(lock, [&] () { return m_quit || m_generation != generation; });
+
+        if(m_quit)
+          return;
+
+        generation = m_generation;
+      }
+
+      m_job(index);
+
+      {
+        lock_guard<mutex> lock(m_mutex);
+        --m_pending;
+      }
+
+      m_done.notify_one();
+    }
+  }
+
+  vector<thread> m_threads;
+  mutex m_mutex;
+  condition_variable m_wakeUp;
+  condition_variable m_done;
+  function<void(int)> m_job;
+  int m_generation = 0;
+  int m_pending = 0;
+  bool m_quit = false;
+};
+
+// below this, spreading the pair detection over threads isn't worth it
+static auto const MIN_PARALLEL_BODIES = 256;
+
+///////////////////////////////////////////////////////////////////////////////
+
 struct Physics : IPhysics
 {
+  Physics(int threadCount)
+  {
+    if(threadCount > 1)
+      m_pool = make_unique<ThreadPool>(threadCount);
+  }
+
   void addBody(Body* body)
   {
+    body->intBox = roundBox(body->getFBox());
+    body->floor = nullptr;
+    body->physicsIndex = (int)m_bodies.size();
     m_bodies.push_back(body);
+    m_cells.push_back(getCells(body->getBox()));
+    m_riders.emplace_back();
+    m_contacts.emplace_back();
+    m_grid.insert(body, m_cells.back());
+    m_awakeGrid.insert(body, m_cells.back());
+    ++m_gridVersion;
+    ++m_changeCount;
+
+    setMembership(body->physicsIndex, body->collisionGroup, body->solid);
   }
 
   void removeBody(Body* body)
   {
-    auto isItTheOne =
-      [ = ] (Body* candidate) { return candidate == body; };
-    unstableRemove(m_bodies, isItTheOne);
+    auto const i = body->physicsIndex;
+
+    if(!isRegistered(body))
+      return;
+
+    wakeUp(i);
+    m_grid.remove(body, m_cells[i]);
+    m_awakeGrid.remove(body, m_cells[i]);
+    ++m_gridVersion;
+    ++m_changeCount;
+
+    setFloor(body, nullptr);
+
+    for(auto rider : m_riders[i])
+      rider->floor = nullptr;
+
+    // move the last body into the hole, like 'unstableRemove' does
+    auto const last = (int)m_bodies.size() - 1;
+    auto moved = m_bodies[last];
+    auto const movedIsAsleep = m_asleep.get(last);
+    auto const movedHasMoved = m_moved.get(last);
+    setMembership(last, 0, false);
+    m_asleep.set(last, false);
+    m_moved.set(last, false);
+
+    if(i != last)
+    {
+      m_bodies[i] = moved;
+      m_cells[i] = m_cells[last];
+      m_riders[i] = move(m_riders[last]);
+      m_contacts[i] = move(m_contacts[last]);
+      moved->physicsIndex = i;
+      setMembership(i, moved->collisionGroup, moved->solid);
+      m_asleep.set(i, movedIsAsleep);
+      m_moved.set(i, movedHasMoved);
+    }
+
+    m_bodies.pop_back();
+    m_cells.pop_back();
+    m_riders.pop_back();
+    m_contacts.pop_back();
+    body->physicsIndex = -1;
   }
 
   bool moveBody(Body* body, Vector delta)
@@ -62,13 +484,14 @@ struct Physics : IPhysics
     else
     {
       auto oldSolid = body->solid;
-      body->solid = false; // make pusher non-solid, so stacked bodies can move down
+      setSolid(body, false); // make pusher non-solid, so stacked bodies can move down
 
       if(body->pusher)
         pushOthers(body, irect, delta);
 
       body->pos = frect.pos;
-      body->solid = oldSolid;
+      setSolid(body, oldSolid);
+      setBox(body, irect);
       // assert(!getSolidBodyInBox(body->getBox(), -1, body));
     }
 
@@ -78,29 +501,124 @@ struct Physics : IPhysics
       auto feet = body->getBox();
       feet.size.height = 16;
       feet.pos.y -= feet.size.height;
-      body->floor = getSolidBodyInBox(feet, -1, body);
+      setFloor(body, getSolidBodyInBox(feet, -1, body));
     }
 
     return !blocked;
   }
 
+  void teleportBody(Body* body, Vector pos)
+  {
+    body->pos = pos;
+    setBox(body, roundBox(body->getFBox()));
+  }
+
+  void resizeBody(Body* body, Size size)
+  {
+    body->size = size;
+    setBox(body, roundBox(body->getFBox()));
+  }
+
+  void setCollisionGroup(Body* body, int collisionGroup)
+  {
+    if(body->collisionGroup == collisionGroup)
+      return;
+
+    body->collisionGroup = collisionGroup;
+
+    if(!isRegistered(body))
+      return;
+
+    setMembership(body->physicsIndex, body->collisionGroup, body->solid);
+
+    // the cached contacts depend on the collision masks
+    wakeUp(body->physicsIndex);
+  }
+
+  void setCollidesWith(Body* body, int collidesWith)
+  {
+    if(body->collidesWith == collidesWith)
+      return;
+
+    body->collidesWith = collidesWith;
+
+    if(isRegistered(body))
+      wakeUp(body->physicsIndex);
+  }
+
+  void setSolid(Body* body, bool solid)
+  {
+    body->solid = solid;
+
+    // the group bitsets don't depend on the solidity
+    if(isRegistered(body))
+      m_solids.set(body->physicsIndex, solid);
+  }
+
+  // Bodies are moved in registration order. Pushed bodies can be pushers
+  // themselves, so this might be called recursively.
   void pushOthers(Body* body, IntBox rect, Vector delta)
   {
+    if(m_pushDepth == (int)m_pushScratch.size())
+      m_pushScratch.emplace_back();
+
+    auto& candidates = m_pushScratch[m_pushDepth++];
+
     // move stacked bodies
-    for(auto otherBody : m_bodies)
+    if(isRegistered(body))
     {
-      if(otherBody->floor == body)
+      candidates.clear();
+
+      for(auto rider : m_riders[body->physicsIndex])
+        candidates.push_back(rider->physicsIndex);
+
+      sort(candidates.begin(), candidates.end());
+
+      for(auto i : candidates)
       {
+        // a collision callback might have moved it elsewhere
+        if(m_bodies[i]->floor != body)
+          continue;
+
         auto delta2 = delta;
         delta2.y *= 0.99;
-        moveBody(otherBody, delta2);
+        moveBody(m_bodies[i], delta2);
       }
     }
 
     // push potential non-solid bodies
-    for(auto other : m_bodies)
-      if(other != body && overlaps(rect, other->getBox()))
-        moveBody(other, delta);
+    {
+      auto const cells = getCells(rect);
+      int last = -1;
+      bool done = false;
+
+      while(!done)
+      {
+        auto const version = m_gridVersion;
+        getCandidates(cells, last, candidates);
+
+        done = true;
+
+        for(auto i : candidates)
+        {
+          // a pushed body moved across cells: query the grid again
+          if(m_gridVersion != version)
+          {
+            done = false;
+            break;
+          }
+
+          last = i;
+
+          auto other = m_bodies[i];
+
+          if(other != body && overlaps(rect, other->getBox()))
+            moveBody(other, delta);
+        }
+      }
+    }
+
+    --m_pushDepth;
   }
 
   bool isSolid(const Body* except, IntBox rect) const
@@ -108,24 +626,139 @@ struct Physics : IPhysics
     if(getSolidBodyInBox(rect, except->collidesWith, except))
       return true;
 
-    if(m_isSolid(rect))
+    if(m_solidityMap && m_solidityMap->isSolid(rect))
+      return true;
+
+    if(m_isSolid && m_isSolid(rect))
       return true;
 
     return false;
   }
 
+  // Equivalent to testing all pairs (i, j), with i < j, in this order.
+  // Pairs which don't share a cell can't overlap, so they're skipped.
+  // Pairs of sleeping bodies aren't tested: their overlaps are cached,
+  // and only if one of the bodies collides with the other.
   void checkForOverlaps()
   {
-    for(auto p : allPairs((int)m_bodies.size()))
+    if(m_pool && (int)m_bodies.size() >= MIN_PARALLEL_BODIES)
+      checkPairsInParallel();
+    else
+      checkPairsFrom(0, 0);
+
+    // bodies which didn't move during this tick fall asleep
+    for(int i = 0; i < (int)m_bodies.size(); ++i)
+      if(!m_asleep.get(i) && !m_moved.get(i))
+        fallAsleep(i);
+
+    m_moved.clear();
+  }
+
+  PhysicsStats getStats() const
+  {
+    PhysicsStats r;
+    r.sleepingBodies = m_asleep.count;
+    r.activeBodies = (int)m_bodies.size() - r.sleepingBodies;
+    return r;
+  }
+
+  // Reports the overlapping pairs in order, starting after the pair
+  // (firstRow, firstLast).
+  void checkPairsFrom(int firstRow, int firstLast)
+  {
+    for(int i = firstRow; i < (int)m_bodies.size(); ++i)
     {
-      auto& me = *m_bodies[p.first];
-      auto& other = *m_bodies[p.second];
+      if(isQuiet(i))
+        continue;
+
+      auto& me = *m_bodies[i];
+      int last = i == firstRow ? max(i, firstLast) : i;
+
+      bool done = false;
+
+      while(!done)
+      {
+        auto const version = m_gridVersion;
+        getOverlapCandidates(i, last, m_candidates);
 
-      auto rect = me.getBox();
-      auto otherBox = other.getBox();
+        done = true;
 
-      if(overlaps(rect, otherBox))
-        collideBodies(me, other);
+        for(auto j : m_candidates)
+        {
+          // a collision callback moved a body across cells, or woke it up:
+          // query the grid again for the remaining pairs.
+          if(m_gridVersion != version)
+          {
+            done = false;
+            break;
+          }
+
+          last = j;
+
+          auto& other = *m_bodies[j];
+
+          auto const bothAsleep = m_asleep.get(i) && m_asleep.get(j);
+
+          if(bothAsleep || overlaps(me.getBox(), other.getBox()))
+            collideBodies(me, other);
+        }
+      }
+    }
+  }
+
+  // Same as 'checkPairsFrom(0, 0)'. The overlapping pairs are first found by
+  // the worker threads, each one handling a contiguous range of rows.
+  // Then, the callbacks are called in order, on this thread.
+  // As soon as a callback changes a body, the remaining pairs are stale:
+  // the sequential version takes over.
+  void checkPairsInParallel()
+  {
+    auto const threadCount = m_pool->size();
+    auto const bodyCount = (int)m_bodies.size();
+
+    m_threadScratch.resize(threadCount);
+
+    auto job = [&] (int t)
+      {
+        auto& scratch = m_threadScratch[t];
+        scratch.pairs.clear();
+
+        auto const firstRow = int(int64_t(bodyCount) * t / threadCount);
+        auto const lastRow = int(int64_t(bodyCount) * (t + 1) / threadCount);
+
+        for(int i = firstRow; i < lastRow; ++i)
+        {
+          if(isQuiet(i))
+            continue;
+
+          getOverlapCandidates(i, i, scratch.candidates);
+
+          for(auto j : scratch.candidates)
+          {
+            auto const bothAsleep = m_asleep.get(i) && m_asleep.get(j);
+
+            if(bothAsleep || overlaps(m_bodies[i]->getBox(), m_bodies[j]->getBox()))
+              scratch.pairs.push_back({ i, j });
+          }
+        }
+      };
+
+    m_pool->run(job);
+
+    auto const changeCount = m_changeCount;
+
+    for(auto& scratch : m_threadScratch)
+    {
+      for(auto pair : scratch.pairs)
+      {
+        collideBodies(*m_bodies[pair.i], *m_bodies[pair.j]);
+
+        if(m_changeCount != changeCount)
+        {
+          checkPairsFrom(pair.i, pair.j);
+          return;
+        }
+      }
     }
   }
 
@@ -143,40 +776,494 @@ struct Physics : IPhysics
     m_isSolid = edifice;
   }
 
+  void setSolidityMap(SolidityMap const* map)
+  {
+    m_solidityMap = map;
+  }
+
+  // returns the first matching body, in registration order
   Body* getBodiesInBox(IntBox myBox, int collisionGroup, bool onlySolid, const Body* except) const
   {
-    for(auto& body : m_bodies)
-    {
-      if(onlySolid && !body->solid)
-        continue;
+    if(countCandidates(collisionGroup, onlySolid) <= MAX_SPARSE_QUERY)
+      return getFirstMemberInBox(myBox, collisionGroup, onlySolid, except);
 
-      if(body == except)
-        continue;
+    Body* first = nullptr;
 
-      if(!(body->collisionGroup & collisionGroup))
-        continue;
+    auto onBody = [&] (Body* body)
+      {
+        if(first && first->physicsIndex <= body->physicsIndex)
+          return;
+
+        if(onlySolid && !body->solid)
+          return;
 
-      auto rect = body->getBox();
+        if(body == except)
+          return;
 
-      if(overlaps(rect, myBox))
-        return body;
+        if(!(body->collisionGroup & collisionGroup))
+          return;
+
+        auto rect = body->getBox();
+
+        if(overlaps(rect, myBox))
+          first = body;
+      };
+
+    m_grid.visit(getCells(myBox), onBody);
+
+    return first;
+  }
+
+  void visitBodiesInBox(IntBox myBox, int collisionGroup, IBodyVisitor& visitor, bool onlySolid, const Body* except) const
+  {
+    if(countCandidates(collisionGroup, onlySolid) <= MAX_SPARSE_QUERY)
+    {
+      visitMembersInBox(myBox, collisionGroup, visitor, onlySolid, except);
+      return;
     }
 
-    return nullptr;
+    if(m_queryDepth == (int)m_queryScratch.size())
+      m_queryScratch.emplace_back();
+
+    // the visitor might run another query
+    auto& matches = m_queryScratch[m_queryDepth++];
+    matches.clear();
+
+    auto onBody = [&] (Body* body)
+      {
+        if(onlySolid && !body->solid)
+          return;
+
+        if(body == except)
+          return;
+
+        if(!(body->collisionGroup & collisionGroup))
+          return;
+
+        if(overlaps(body->getBox(), myBox))
+          matches.push_back(body->physicsIndex);
+      };
+
+    m_grid.visit(getCells(myBox), onBody);
+
+    sort(matches.begin(), matches.end());
+    matches.erase(unique(matches.begin(), matches.end()), matches.end());
+
+    for(auto i : matches)
+      visitor.visit(m_bodies[i]);
+
+    --m_queryDepth;
+  }
+
+  RaycastResult raycast(Vector from, Vector to, int collisionGroup, const Body* except) const
+  {
+    auto const delta = to - from;
+
+    // first solid cell of the edifice
+    float tHit = 2;
+
+    auto onTile = [&] (int col, int row, float tEnter, float /*tExit*/)
+      {
+        if(!isCellSolid(col, row))
+          return true;
+
+        tHit = tEnter;
+        return false;
+      };
+
+    traverseCells(from, delta, 1, onTile);
+
+    // first body, closer than this cell
+    Body* hitBody = nullptr;
+
+    auto onCell = [&] (int x, int y, float tEnter, float /*tExit*/)
+      {
+        // the remaining cells are farther than the current hit
+        if(tEnter > tHit)
+          return false;
+
+        auto onBody = [&] (Body* body)
+          {
+            if(body == except || !(body->collisionGroup & collisionGroup))
+              return;
+
+            auto const t = intersectSegment(from, delta, body->getBox());
+
+            if(t < 0 || t > tHit)
+              return;
+
+            // keep the result independent from the bucket order
+            if(t == tHit && hitBody && hitBody->physicsIndex < body->physicsIndex)
+              return;
+
+            tHit = t;
+            hitBody = body;
+          };
+
+        m_grid.visit(x, y, onBody);
+        return true;
+      };
+
+    if(collisionGroup)
+      traverseCells(from, delta, CELL_SIZE / float(PRECISION), onCell);
+
+    RaycastResult r;
+
+    if(tHit > 1)
+      return r;
+
+    r.hit = true;
+    r.distance = tHit * sqrt(delta.x * delta.x + delta.y * delta.y);
+    r.body = hitBody;
+    return r;
   }
 
 private:
+  bool isCellSolid(int col, int row) const
+  {
+    if(m_solidityMap)
+    {
+      auto const size = m_solidityMap->size;
+
+      if(col >= 0 && row >= 0 && col < size.width && row < size.height && m_solidityMap->isSolid(col, row))
+        return true;
+    }
+
+    if(m_isSolid && m_isSolid(IntBox(col * PRECISION, row * PRECISION, 0, 0)))
+      return true;
+
+    return false;
+  }
+
   Body* getSolidBodyInBox(IntBox myBox, int collisionGroup, const Body* except) const
   {
     return getBodiesInBox(myBox, collisionGroup, true, except);
   }
 
+  bool isRegistered(const Body* body) const
+  {
+    auto const i = body->physicsIndex;
+    return i >= 0 && i < (int)m_bodies.size() && m_bodies[i] == body;
+  }
+
+  void setMembership(int i, int collisionGroup, bool solid)
+  {
+    for(int bit = 0; bit < 32; ++bit)
+      m_groups[bit].set(i, collisionGroup & (1u << bit));
+
+    m_solids.set(i, solid);
+  }
+
+  // what the membership bitsets say, from the live fields
+  static bool isMember(const Body* body, int collisionGroup, bool onlySolid)
+  {
+    return (body->collisionGroup & collisionGroup) && (!onlySolid || body->solid);
+  }
+
+  // upper bound of the number of bodies matching a query
+  int countCandidates(int collisionGroup, bool onlySolid) const
+  {
+    int count = 0;
+
+    for(int bit = 0; bit < 32; ++bit)
+      if(collisionGroup & (1u << bit))
+        count += m_groups[bit].count;
+
+    if(onlySolid)
+      count = min(count, m_solids.count);
+
+    return count;
+  }
+
+  // same as 'getBodiesInBox', but only iterates over the bodies whose
+  // collision group and solidity match.
+  Body* getFirstMemberInBox(IntBox myBox, int collisionGroup, bool onlySolid, const Body* except) const
+  {
+    auto const wordCount = ((int)m_bodies.size() + 63) / 64;
+
+    for(int w = 0; w < wordCount; ++w)
+    {
+      uint64_t members = 0;
+
+      for(int bit = 0; bit < 32; ++bit)
+        if(collisionGroup & (1u << bit))
+          members |= m_groups[bit].word(w);
+
+      if(onlySolid)
+        members &= m_solids.word(w);
+
+      while(members)
+      {
+        auto const i = w * 64 + __builtin_ctzll(members);
+        members &= members - 1;
+
+        auto body = m_bodies[i];
+
+        // the fields must only be changed through the physics
+        assert(isMember(body, collisionGroup, onlySolid));
+
+        if(body != except && overlaps(body->getBox(), myBox))
+          return body;
+      }
+    }
+
+    return nullptr;
+  }
+
+  // same as 'visitBodiesInBox', but only iterates over the bodies whose
+  // collision group and solidity match.
+  void visitMembersInBox(IntBox myBox, int collisionGroup, IBodyVisitor& visitor, bool onlySolid, const Body* except) const
+  {
+    auto const wordCount = ((int)m_bodies.size() + 63) / 64;
+
+    for(int w = 0; w < wordCount; ++w)
+    {
+      uint64_t members = 0;
+
+      for(int bit = 0; bit < 32; ++bit)
+        if(collisionGroup & (1u << bit))
+          members |= m_groups[bit].word(w);
+
+      if(onlySolid)
+        members &= m_solids.word(w);
+
+      while(members)
+      {
+        auto const i = w * 64 + __builtin_ctzll(members);
+        members &= members - 1;
+
+        auto body = m_bodies[i];
+
+        // the fields must only be changed through the physics
+        assert(isMember(body, collisionGroup, onlySolid));
+
+        if(body != except && overlaps(body->getBox(), myBox))
+          visitor.visit(body);
+      }
+    }
+  }
+
+  // must be called whenever the fixed-point box of a body changes
+  void setBox(Body* body, IntBox box)
+  {
+    if(body->intBox == box)
+      return;
+
+    body->intBox = box;
+
+    if(!isRegistered(body))
+      return;
+
+    auto const i = body->physicsIndex;
+    wakeUp(i);
+    m_moved.set(i, true);
+    ++m_changeCount;
+
+    // keep the broadphase in sync with the body position
+    auto& cells = m_cells[i];
+    auto const newCells = getCells(box);
+
+    if(newCells == cells)
+      return;
+
+    m_grid.remove(body, cells);
+    m_awakeGrid.remove(body, cells);
+    cells = newCells;
+    m_grid.insert(body, cells);
+    m_awakeGrid.insert(body, cells);
+    ++m_gridVersion;
+  }
+
+  // A sleeping body hasn't moved since the end of the last checkForOverlaps.
+  // It's removed from the 'awake' grid, and its overlaps with the other
+  // sleeping bodies are cached into 'm_contacts'.
+  void fallAsleep(int i)
+  {
+    auto body = m_bodies[i];
+    auto& contacts = m_contacts[i];
+
+    assert(contacts.empty());
+
+    auto onBody = [&] (Body* other)
+      {
+        if(other == body || !m_asleep.get(other->physicsIndex))
+          return;
+
+        if(interacts(*body, *other) && overlaps(body->getBox(), other->getBox()))
+          contacts.push_back(other);
+      };
+
+    m_grid.visit(m_cells[i], onBody);
+
+    sort(contacts.begin(), contacts.end());
+    contacts.erase(unique(contacts.begin(), contacts.end()), contacts.end());
+
+    for(auto other : contacts)
+      m_contacts[other->physicsIndex].push_back(body);
+
+    m_awakeGrid.remove(body, m_cells[i]);
+    m_asleep.set(i, true);
+    ++m_gridVersion;
+  }
+
+  void wakeUp(int i)
+  {
+    if(!m_asleep.get(i))
+      return;
+
+    auto body = m_bodies[i];
+
+    for(auto other : m_contacts[i])
+    {
+      auto& otherContacts = m_contacts[other->physicsIndex];
+      otherContacts.erase(std::find(otherContacts.begin(), otherContacts.end(), body));
+    }
+
+    m_contacts[i].clear();
+
+    m_awakeGrid.insert(body, m_cells[i]);
+    m_asleep.set(i, false);
+    ++m_gridVersion;
+  }
+
+  // a sleeping body, with no cached contact and no awake body around:
+  // none of its pairs needs to be tested.
+  bool isQuiet(int i) const
+  {
+    return m_asleep.get(i) && m_contacts[i].empty() && m_awakeGrid.isEmpty(m_cells[i]);
+  }
+
+  // whether 'collideBodies' does anything for this pair
+  static bool interacts(Body const& a, Body const& b)
+  {
+    return (a.collidesWith & b.collisionGroup) || (b.collidesWith & a.collisionGroup);
+  }
+
+  // stores into 'result' the sorted indices, greater than 'minIndex',
+  // of the bodies that might overlap with the body 'i'.
+  void getOverlapCandidates(int i, int minIndex, vector<int>& result) const
+  {
+    if(!m_asleep.get(i))
+    {
+      getCandidates(m_cells[i], minIndex, result);
+      return;
+    }
+
+    // sleeping body: only the awake bodies, and the cached overlaps
+    result.clear();
+
+    auto onBody = [&] (Body* other)
+      {
+        if(other->physicsIndex > minIndex)
+          result.push_back(other->physicsIndex);
+      };
+
+    m_awakeGrid.visit(m_cells[i], onBody);
+
+    for(auto other : m_contacts[i])
+      onBody(other);
+
+    sort(result.begin(), result.end());
+    result.erase(unique(result.begin(), result.end()), result.end());
+  }
+
+  // stores into 'result' the sorted indices, greater than 'minIndex',
+  // of the bodies registered in 'cells'.
+  void getCandidates(CellRange cells, int minIndex, vector<int>& result) const
+  {
+    result.clear();
+
+    auto onBody = [&] (Body* other)
+      {
+        if(other->physicsIndex > minIndex)
+          result.push_back(other->physicsIndex);
+      };
+
+    m_grid.visit(cells, onBody);
+
+    sort(result.begin(), result.end());
+    result.erase(unique(result.begin(), result.end()), result.end());
+  }
+
+  // keep the reverse index of 'floor' up to date
+  void setFloor(Body* body, Body* floor)
+  {
+    if(body->floor == floor)
+      return;
+
+    if(body->floor && isRegistered(body->floor))
+    {
+      auto& riders = m_riders[body->floor->physicsIndex];
+
+      for(auto& rider : riders)
+      {
+        if(rider == body)
+        {
+          rider = riders.back();
+          riders.pop_back();
+          break;
+        }
+      }
+    }
+
+    body->floor = floor;
+
+    if(floor && isRegistered(floor) && isRegistered(body))
+      m_riders[floor->physicsIndex].push_back(body);
+  }
+
   vector<Body*> m_bodies;
   function<bool(IntBox)> m_isSolid;
+  SolidityMap const* m_solidityMap = nullptr;
+
+  // broadphase
+  vector<CellRange> m_cells; // indexed like 'm_bodies'
+  SpatialHash m_grid;
+  int m_gridVersion = 0;
+  vector<int> m_candidates;
+
+  // bodies standing on each body, indexed like 'm_bodies'
+  vector<vector<Body*>> m_riders;
+
+  // sleeping bodies
+  SpatialHash m_awakeGrid; // only contains awake bodies
+  vector<vector<Body*>> m_contacts; // overlapping sleeping bodies, indexed like 'm_bodies'
+  BodySet m_asleep;
+  BodySet m_moved; // bodies moved since the last checkForOverlaps
+
+  // candidate lists for pushOthers, one per recursion level
+  deque<vector<int>> m_pushScratch;
+  int m_pushDepth = 0;
+
+  // incremented each time a body is added, removed, moved or resized
+  int m_changeCount = 0;
+
+  // parallel pair detection
+  struct Pair
+  {
+    int i, j;
+  };
+
+  struct ThreadScratch
+  {
+    vector<int> candidates;
+    vector<Pair> pairs;
+  };
+
+  unique_ptr<ThreadPool> m_pool;
+  vector<ThreadScratch> m_threadScratch;
+
+  // matches for visitBodiesInBox, one per nesting level
+  mutable deque<vector<int>> m_queryScratch;
+  mutable int m_queryDepth = 0;
+
+  // membership, indexed like 'm_bodies'
+  BodySet m_groups[32]; // one per collision group bit
+  BodySet m_solids;
 };
 
-unique_ptr<IPhysics> createPhysics()
+unique_ptr<IPhysics> createPhysics(int threadCount)
 {
-  return make_unique<Physics>();
+  return make_unique<Physics>(threadCount);
 }
 
@@ -10,6 +10,13 @@
 
 #include "body.h"
 #include "physics_probe.h"
+#include "solidity_map.h"
+
+struct PhysicsStats
+{
+  int activeBodies;
+  int sleepingBodies;
+};
 
 struct IPhysics : IPhysicsProbe
 {
@@ -18,9 +25,16 @@ struct IPhysics : IPhysicsProbe
   virtual void addBody(Body* body) = 0;
   virtual void removeBody(Body* body) = 0;
   virtual void checkForOverlaps() = 0;
+  virtual PhysicsStats getStats() const = 0;
   virtual void setEdifice(function<bool(IntBox)> isSolid) = 0;
+
+  // fast path for tile-based edifices. 'map' must outlive the physics.
+  virtual void setSolidityMap(SolidityMap const* map) = 0;
 };
 
 #include <memory>
-unique_ptr<IPhysics> createPhysics();
+// 'threadCount' threads are used to find the overlapping pairs.
+// The collision callbacks are always called on the calling thread,
+// in the same order, whatever the thread count.
+unique_ptr<IPhysics> createPhysics(int threadCount = 1);
 
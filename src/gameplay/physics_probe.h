@@ -10,10 +10,58 @@
 
 #include "body.h"
 
+struct RaycastResult
+{
+  bool hit = false;
+  float distance = 0; // from the start of the ray to the hit point
+  Body* body = nullptr; // the hit body, or null if the ray hit the edifice
+};
+
+struct IBodyVisitor
+{
+  virtual void visit(Body* body) = 0;
+};
+
 struct IPhysicsProbe
 {
   virtual bool moveBody(Body* body, Vector delta) = 0;
+
+  // Bodies registered in the physics must not be modified directly.
+  // These change the position/shape of a body, without any collision check.
+  virtual void teleportBody(Body* body, Vector pos) = 0;
+  virtual void resizeBody(Body* body, Size size) = 0;
+  virtual void setCollisionGroup(Body* body, int collisionGroup) = 0;
+  virtual void setSolid(Body* body, bool solid) = 0;
+  virtual void setCollidesWith(Body* body, int collidesWith) = 0;
+
   virtual bool isSolid(const Body* body, IntBox) const = 0;
   virtual Body* getBodiesInBox(IntBox myBox, int collisionGroup, bool onlySolid = false, const Body* except = nullptr) const = 0;
+
+  // Reports every matching body, in registration order, without allocating.
+  // The visitor may move bodies, but must not add or remove any.
+  virtual void visitBodiesInBox(IntBox myBox, int collisionGroup, IBodyVisitor& visitor, bool onlySolid = false, const Body* except = nullptr) const = 0;
+
+  // Finds the first thing on the segment [from, to]: a solid cell of the
+  // edifice, or a body from 'collisionGroup' (pass 0 to only test the edifice).
+  virtual RaycastResult raycast(Vector from, Vector to, int collisionGroup, const Body* except = nullptr) const = 0;
+
+  template<typename Lambda>
+  void forEachBodyInBox(IntBox myBox, int collisionGroup, Lambda f, bool onlySolid = false, const Body* except = nullptr) const
+  {
+    struct Visitor : IBodyVisitor
+    {
+      Visitor(Lambda& f_) : f(f_) {}
+
+      void visit(Body* body) override
+      {
+        f(body);
+      }
+
+      Lambda& f;
+    };
+
+    Visitor visitor(f);
+    visitBodiesInBox(myBox, collisionGroup, visitor, onlySolid, except);
+  }
 };
 
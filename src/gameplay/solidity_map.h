@@ -0,0 +1,89 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+// Bit-packed map of the solid cells of a room.
+// Each row is stored as an array of 64-bit words, so a box can be tested
+// with a few word-wide masks per row.
+
+#pragma once
+
+#include <algorithm> // min, max
+#include <cstdint>
+#include <vector>
+
+#include "vec.h"
+
+struct SolidityMap
+{
+  SolidityMap() = default;
+
+  SolidityMap(Size2i size_) : size(size_)
+  {
+    wordsPerRow = (size.width + 63) / 64;
+    bits.assign(wordsPerRow * size.height, 0);
+  }
+
+  void set(int col, int row)
+  {
+    bits[row * wordsPerRow + col / 64] |= uint64_t(1) << (col % 64);
+  }
+
+  bool isSolid(int col, int row) const
+  {
+    return bits[row * wordsPerRow + col / 64] & (uint64_t(1) << (col % 64));
+  }
+
+  // 'box' is in fixed-point units. Cells outside of the map aren't solid.
+  bool isSolid(IntBox box) const
+  {
+    auto const x1 = box.pos.x;
+    auto const y1 = box.pos.y;
+    auto const x2 = box.pos.x + box.size.width;
+    auto const y2 = box.pos.y + box.size.height;
+
+    auto const col1 = std::max(x1 / PRECISION, 0);
+    auto const col2 = std::min(x2 / PRECISION, size.width - 1);
+    auto const row1 = std::max(y1 / PRECISION, 0);
+    auto const row2 = std::min(y2 / PRECISION, size.height - 1);
+
+    if(col1 > col2)
+      return false;
+
+    auto const w1 = col1 / 64;
+    auto const w2 = col2 / 64;
+    auto const firstMask = ~uint64_t(0) << (col1 % 64);
+    auto const lastMask = ~uint64_t(0) >> (63 - col2 % 64);
+
+    for(int row = row1; row <= row2; row++)
+    {
+      auto const words = &bits[row * wordsPerRow];
+
+      if(w1 == w2)
+      {
+        if(words[w1] & firstMask & lastMask)
+          return true;
+
+        continue;
+      }
+
+      if(words[w1] & firstMask)
+        return true;
+
+      for(int w = w1 + 1; w < w2; ++w)
+        if(words[w])
+          return true;
+
+      if(words[w2] & lastMask)
+        return true;
+    }
+
+    return false;
+  }
+
+  Size2i size;
+  int wordsPerRow = 0;
+  std::vector<uint64_t> bits;
+};
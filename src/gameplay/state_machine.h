@@ -11,3 +11,6 @@ Scene* createPlayingState(View* view);
 Scene* createEndingState(View* view);
 Scene* createPlayingStateAtLevel(View* view, int level);
 
+// number of threads used by the physics of the next loaded rooms
+void setPhysicsThreadCount(int count);
+
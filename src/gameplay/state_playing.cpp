@@ -26,6 +26,8 @@
 
 using namespace std;
 
+static int g_physicsThreadCount = 1;
+
 struct EntityConfigImpl : IEntityConfig
 {
   string getString(const char* varName, string defaultValue) override
@@ -114,7 +116,7 @@ struct GameState : Scene, private IGame
     if(!m_player)
       return;
 
-    sendActorsForTileMap();
+    m_view->sendTileLayer(-1);
 
     vector<Actor> actors;
 
@@ -165,6 +167,10 @@ struct GameState : Scene, private IGame
 
     m_physics->checkForOverlaps();
     removeDeadThings();
+
+    auto const stats = m_physics->getStats();
+    m_view->setStat("Active bodies", stats.activeBodies);
+    m_view->setStat("Sleeping bodies", stats.sleepingBodies);
   }
 
   void processEvents()
@@ -195,26 +201,6 @@ struct GameState : Scene, private IGame
     m_view->setCameraPos(cameraPos);
   }
 
-  void sendActorsForTileMap() const
-  {
-    auto const model = MDL_TILES_00 + m_theme % 8;
-
-    auto onCell =
-      [&] (int x, int y, int tile)
-      {
-        if(tile == -1)
-          return;
-
-        auto actor = Actor { Vector(x, y), model };
-        actor.action = tile;
-        actor.scale = UnitSize;
-        actor.zOrder = -1;
-        m_view->sendActor(actor);
-      };
-
-    m_tilesForDisplay->scan(onCell);
-  }
-
   void removeDeadThings()
   {
     for(auto& entity : m_entities)
@@ -277,18 +263,19 @@ struct GameState : Scene, private IGame
     // create new game arena
     ///////////////////////////////////////////////////////////////////////////
 
-    m_physics = createPhysics();
-    m_physics->setEdifice(bind(&GameState::isBoxSolid, this, placeholders::_1));
-
     if(levelIdx < 0 || levelIdx >= (int)m_quest.rooms.size())
       throw Error("No such level");
 
     m_currRoom = &m_quest.rooms[levelIdx];
 
+    m_solidityMap = computeSolidityMap(m_currRoom->tiles);
+    m_physics = createPhysics(g_physicsThreadCount);
+    m_physics->setSolidityMap(&m_solidityMap);
+
     auto& level = m_quest.rooms[levelIdx];
     spawnEntities(level, this, levelIdx);
-    m_tilesForDisplay = &level.tilesForDisplay;
     m_theme = level.theme;
+    m_view->setTileLayer(MDL_TILES_00 + m_theme % 8, level.tilesForDisplay);
     m_view->playMusic(level.theme);
 
     // load new background
@@ -403,40 +390,32 @@ struct GameState : Scene, private IGame
   unique_ptr<IPhysics> m_physics;
   bool m_gameFinished = false;
 
-  const Matrix2<int>* m_tilesForDisplay;
   bool m_debug;
   Toggle startButton;
 
   vector<unique_ptr<Entity>> m_entities;
   vector<unique_ptr<Entity>> m_spawned;
 
-  bool isBoxSolid(IntBox box)
-  {
-    auto const x1 = box.pos.x;
-    auto const y1 = box.pos.y;
-    auto const x2 = box.pos.x + box.size.width;
-    auto const y2 = box.pos.y + box.size.height;
-
-    auto const col1 = x1 / PRECISION;
-    auto const col2 = x2 / PRECISION;
-    auto const row1 = y1 / PRECISION;
-    auto const row2 = y2 / PRECISION;
-
-    for(int row = row1; row <= row2; row++)
-      for(int col = col1; col <= col2; col++)
-        if(m_currRoom->tiles.isInside(col, row))
-        {
-          const auto tile = m_currRoom->tiles.get(col, row);
-
-          if(tile != 0 && tile < 16)
-            return true;
-        }
-
-    return false;
-  }
+  SolidityMap m_solidityMap;
 
   // static stuff
 
+  static SolidityMap computeSolidityMap(Matrix2<int> const& tiles)
+  {
+    SolidityMap r(tiles.size);
+
+    auto onCell =
+      [&] (int x, int y, int tile)
+      {
+        if(tile != 0 && tile < 16)
+          r.set(x, y);
+      };
+
+    tiles.scan(onCell);
+
+    return r;
+  }
+
   static Actor getDebugActor(Entity* entity)
   {
     auto box = entity->getFBox();
@@ -447,6 +426,11 @@ struct GameState : Scene, private IGame
   }
 };
 
+void setPhysicsThreadCount(int count)
+{
+  g_physicsThreadCount = count;
+}
+
 Scene* createPlayingStateAtLevel(View* view, int level)
 {
   auto gameState = make_unique<GameState>(view);
@@ -94,10 +94,18 @@ struct SdlAudioBackend : IAudioBackend
     }
   }
 };
+
+// e.g for machines without an audio device
+struct NullAudioBackend : IAudioBackend
+{
+};
 }
 
-IAudioBackend* createAudioBackend(IAudioMixer* mixer)
+IAudioBackend* createAudioBackend(IAudioMixer* mixer, bool headless)
 {
+  if(headless)
+    return new NullAudioBackend;
+
   return new SdlAudioBackend(mixer);
 }
 
@@ -6,8 +6,12 @@
 
 // OpenGL stuff
 
+#include <algorithm> // stable_sort
 #include <array>
 #include <cassert>
+#include <climits> // INT_MAX
+#include <cmath> // lround
+#include <cstddef> // offsetof
 #include <cstdio>
 #include <unordered_map>
 #include <vector>
@@ -18,7 +22,6 @@ using namespace std;
 
 #include "base/error.h"
 #include "base/geom.h"
-#include "base/my_algorithm.h" // sort
 #include "base/scene.h"
 #include "base/span.h"
 #include "base/util.h" // clamp
@@ -26,11 +29,15 @@ using namespace std;
 #include "engine/stats.h"
 #include "misc/file.h"
 #include "misc/util.h"
-#include "render/matrix3.h"
+#include "render/atlas.h"
 #include "render/model.h"
 #include "render/picture.h"
+#include "render/picture_loader.h"
+#include "render/quad.h"
+#include "render/text_cache.h"
 
 extern const Span<uint8_t> VertexShaderCode;
+extern const Span<uint8_t> InstancedVertexShaderCode;
 extern const Span<uint8_t> FragmentShaderCode;
 
 #ifdef NDEBUG
@@ -42,7 +49,7 @@ extern const Span<uint8_t> FragmentShaderCode;
 
 namespace
 {
-const int MAX_VERTICES = 8192;
+const int MAX_VERTICES = 4 * 16384; // capacity of the streaming vertex buffer. Must fit 16-bit indices.
 
 void ensureGl(char const* expr, int line)
 {
@@ -139,20 +146,75 @@ GLuint sendToOpengl(PictureView pic)
 
   return texture;
 }
-}
 
-// exported to Model
-int loadTexture(String path, Rect2f frect)
+///////////////////////////////////////////////////////////////////////////////
+// All the frames of all the models are packed into a few big textures.
+
+auto const ATLAS_PAGE_SIZE = Size2i(2048, 2048);
+auto const ATLAS_PADDING = 1; // transparent border around each frame
+
+#ifdef __EMSCRIPTEN__
+auto const PICTURE_LOADER_THREADS = 0; // no threads: decode from the frame loop
+#else
+auto const PICTURE_LOADER_THREADS = 2;
+#endif
+
+// a frame, inside its atlas page
+struct TextureRegion
 {
-  auto pic = loadPicture(path, frect);
-  return sendToOpengl(pic);
+  GLuint texture;
+  Rect2f uv;
+  bool ready = true; // false while the placeholder is used
+};
+
+struct TextureAtlas
+{
+  Atlas allocator { ATLAS_PAGE_SIZE };
+  vector<GLuint> pages;
+  vector<TextureRegion> regions;
+};
+
+TextureAtlas g_atlas;
+
+GLuint createAtlasPage()
+{
+  vector<uint8_t> transparent(ATLAS_PAGE_SIZE.width * ATLAS_PAGE_SIZE.height * 4);
+  return sendToOpengl({ ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE.width * 4, transparent.data() });
 }
 
-namespace
+TextureRegion addToAtlas(PictureView pic)
 {
-GLuint loadShaders()
+  auto const paddedSize = Size2i(pic.dim.width + 2 * ATLAS_PADDING, pic.dim.height + 2 * ATLAS_PADDING);
+
+  // too big: give it its own texture
+  if(paddedSize.width > ATLAS_PAGE_SIZE.width || paddedSize.height > ATLAS_PAGE_SIZE.height)
+    return { sendToOpengl(pic), Rect2f(0, 0, 1, 1) };
+
+  auto const slot = g_atlas.allocator.allocate(paddedSize);
+
+  while((int)g_atlas.pages.size() <= slot.page)
+    g_atlas.pages.push_back(createAtlasPage());
+
+  auto const texture = g_atlas.pages[slot.page];
+  auto const x = slot.rect.pos.x + ATLAS_PADDING;
+  auto const y = slot.rect.pos.y + ATLAS_PADDING;
+
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, pic.dim.width, pic.dim.height, GL_RGBA, GL_UNSIGNED_BYTE, pic.pixels);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  TextureRegion r;
+  r.texture = texture;
+  r.uv.pos.x = x / float(ATLAS_PAGE_SIZE.width);
+  r.uv.pos.y = y / float(ATLAS_PAGE_SIZE.height);
+  r.uv.size.width = pic.dim.width / float(ATLAS_PAGE_SIZE.width);
+  r.uv.size.height = pic.dim.height / float(ATLAS_PAGE_SIZE.height);
+  return r;
+}
+
+GLuint loadShaders(Span<uint8_t> vertexShaderCode)
 {
-  auto const vertexId = compileShader(VertexShaderCode, GL_VERTEX_SHADER);
+  auto const vertexId = compileShader(vertexShaderCode, GL_VERTEX_SHADER);
   auto const fragmentId = compileShader(FragmentShaderCode, GL_FRAGMENT_SHADER);
 
   auto const progId = linkShaders(vector<int>({ vertexId, fragmentId }));
@@ -163,12 +225,6 @@ GLuint loadShaders()
   return progId;
 }
 
-struct Camera
-{
-  Vector2f pos = Vector2f(0, 0);
-  float angle = 0;
-};
-
 void printOpenGlVersion()
 {
   auto sVersion = (char const*)glGetString(GL_VERSION);
@@ -184,18 +240,174 @@ void printOpenGlVersion()
          notNull(sLangVersion));
 }
 
-// VBO format
+// VBO format of the batched path
 struct Vertex
 {
-  float x, y, u, v;
+  float x, y;
+  uint16_t u, v; // normalized
+  std::array<int8_t, 4> light; // normalized, the 4th component is padding
 };
 
-template<typename T>
-T blend(T a, T b, float alpha)
+// VBO format of the tile mesh: the light is the same for the whole mesh
+struct TileVertex
 {
-  return a * (1 - alpha) + b * alpha;
+  float x, y;
+  uint16_t u, v; // normalized
+};
+
+// per-instance data of the instanced path
+struct Instance
+{
+  float x, y; // origin of the quad, relative to the camera
+  float width, height;
+  float angle;
+  uint16_t uv[4]; // normalized (u0, v0, u1, v1)
+  float light[3];
+};
+
+uint16_t toUnorm16(float val)
+{
+  return uint16_t(::clamp(val, 0.0f, 1.0f) * 65535.0f + 0.5f);
 }
 
+// The light is added to texture colors: beyond [-1, 1], the result
+// is black or white anyway.
+std::array<int8_t, 4> toSnorm8(std::array<float, 3> light)
+{
+  std::array<int8_t, 4> r {};
+
+  for(int i = 0; i < 3; ++i)
+    r[i] = int8_t(lround(::clamp(light[i], -1.0f, 1.0f) * 127.0f));
+
+  return r;
+}
+
+// quads are drawn as 4 vertices, the triangles are described by this
+// static index buffer: (0, 1, 2), (0, 2, 3), then the same for the next quad.
+GLuint createQuadIndexBuffer(int quadCount)
+{
+  vector<uint16_t> indices;
+  indices.reserve(quadCount * 6);
+
+  for(int i = 0; i < quadCount; ++i)
+  {
+    auto const base = uint16_t(i * 4);
+    indices.push_back(base + 0);
+    indices.push_back(base + 1);
+    indices.push_back(base + 2);
+    indices.push_back(base + 0);
+    indices.push_back(base + 2);
+    indices.push_back(base + 3);
+  }
+
+  GLuint ibo;
+  SAFE_GL(glGenBuffers(1, &ibo));
+  SAFE_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo));
+  SAFE_GL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(indices[0]), indices.data(), GL_STATIC_DRAW));
+
+  return ibo;
+}
+
+// Streams vertices (or instances) into a ring buffer, drawn with offsets.
+// When the ring is full, its storage is orphaned: the driver can then
+// allocate a new one, without waiting for the GPU to be done with the old one.
+template<typename Element>
+struct StreamRing
+{
+  void init(int capacity)
+  {
+    m_capacity = capacity;
+    SAFE_GL(glGenBuffers(1, &m_vbo));
+    SAFE_GL(glBindBuffer(GL_ARRAY_BUFFER, m_vbo));
+    SAFE_GL(glBufferData(GL_ARRAY_BUFFER, m_capacity * sizeof(Element), nullptr, GL_STREAM_DRAW));
+    SAFE_GL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+
+#ifdef __EMSCRIPTEN__
+    m_staging.resize(m_capacity);
+#endif
+  }
+
+  GLuint vbo() const
+  {
+    return m_vbo;
+  }
+
+  // Returns room for 'count' elements, following the pending ones.
+  // Returns null if there's not enough room: the pending elements must
+  // be committed first.
+  // The ring buffer must be bound to GL_ARRAY_BUFFER.
+  Element* allocate(int count)
+  {
+    if(!m_mapped)
+      map(count);
+
+    if(m_first + m_count + count > m_capacity)
+      return nullptr;
+
+    auto r = m_mapped + m_count;
+    m_count += count;
+    return r;
+  }
+
+  int pendingCount() const
+  {
+    return m_count;
+  }
+
+  // makes the pending elements available for drawing.
+  // Returns the index of the first one in the buffer.
+  int commit()
+  {
+    auto const first = m_first;
+
+#ifdef __EMSCRIPTEN__
+    // WebGL can't map buffers
+    SAFE_GL(glBufferSubData(GL_ARRAY_BUFFER, m_first * sizeof(Element), m_count * sizeof(Element), m_mapped));
+#else
+    SAFE_GL(glFlushMappedBufferRange(GL_ARRAY_BUFFER, 0, m_count * sizeof(Element)));
+    SAFE_GL(glUnmapBuffer(GL_ARRAY_BUFFER));
+#endif
+
+    m_mapped = nullptr;
+    m_first += m_count;
+    m_count = 0;
+
+    return first;
+  }
+
+private:
+  void map(int count)
+  {
+    // wrap around
+    if(m_first + count > m_capacity)
+    {
+      SAFE_GL(glBufferData(GL_ARRAY_BUFFER, m_capacity * sizeof(Element), nullptr, GL_STREAM_DRAW));
+      m_first = 0;
+    }
+
+#ifdef __EMSCRIPTEN__
+    m_mapped = m_staging.data();
+#else
+    // the region after 'm_first' isn't used by any pending draw call
+    auto const flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_FLUSH_EXPLICIT_BIT;
+    m_mapped = (Element*)glMapBufferRange(GL_ARRAY_BUFFER, m_first * sizeof(Element), (m_capacity - m_first) * sizeof(Element), flags);
+
+    if(!m_mapped)
+      throw Error("Can't map the vertex buffer");
+#endif
+  }
+
+  GLuint m_vbo = 0;
+  int m_capacity = 0;
+  int m_first = 0; // index of the first pending element
+  int m_count = 0; // number of pending elements
+  Element* m_mapped = nullptr;
+
+#ifdef __EMSCRIPTEN__
+  vector<Element> m_staging;
+#endif
+};
+
 struct OpenglDisplay : Display
 {
   OpenglDisplay(Size2i resolution)
@@ -237,20 +449,20 @@ struct OpenglDisplay : Display
     // Enable vsync (disabled, at it seems to have the opposite effect (!))
     // SDL_GL_SetSwapInterval(1);
 
-    // Create our unique vertex array
-    GLuint VertexArrayID;
-    SAFE_GL(glGenVertexArrays(1, &VertexArrayID));
-    SAFE_GL(glBindVertexArray(VertexArrayID));
+    // Create our main vertex array
+    SAFE_GL(glGenVertexArrays(1, &m_vertexArray));
+    SAFE_GL(glBindVertexArray(m_vertexArray));
 
-    m_shader.programId = loadShaders();
+    m_shader.programId = loadShaders(VertexShaderCode);
 
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    m_fontModel = ::loadModel("res/font.model");
+    m_loadTexture = [this] (String path, Rect2f rect) { return loadTexture(path, rect); };
+    m_fontModel = ::loadModel("res/font.model", m_loadTexture);
 
-    m_shader.colorId = glGetUniformLocation(m_shader.programId, "fragOffset");
-    assert(m_shader.colorId >= 0);
+    m_shader.lightLoc = glGetAttribLocation(m_shader.programId, "vertexLightOffset");
+    assert(m_shader.lightLoc >= 0);
 
     m_shader.positionLoc = glGetAttribLocation(m_shader.programId, "vertexPos_model");
     assert(m_shader.positionLoc >= 0);
@@ -258,7 +470,27 @@ struct OpenglDisplay : Display
     m_shader.texCoordLoc = glGetAttribLocation(m_shader.programId, "vertexUV");
     assert(m_shader.texCoordLoc >= 0);
 
-    SAFE_GL(glGenBuffers(1, &m_batchVbo));
+    m_shader.offsetId = glGetUniformLocation(m_shader.programId, "positionOffset");
+    assert(m_shader.offsetId >= 0);
+
+    m_shader.scaleId = glGetUniformLocation(m_shader.programId, "positionScale");
+    assert(m_shader.scaleId >= 0);
+
+    // batched vertices are already in clip space
+    SAFE_GL(glUseProgram(m_shader.programId));
+    SAFE_GL(glUniform2f(m_shader.offsetId, 0, 0));
+    SAFE_GL(glUniform1f(m_shader.scaleId, 1));
+
+    m_batchRing.init(MAX_VERTICES);
+    m_quadIndices = createQuadIndexBuffer(MAX_VERTICES / 4);
+
+    // instancing is core in OpenGL ES 3.0, but isn't exposed by all drivers
+    m_useInstancing = glDrawElementsInstanced && glVertexAttribDivisor;
+
+    if(m_useInstancing)
+      initInstancing();
+
+    printf("[display] using %s rendering\n", m_useInstancing ? "instanced" : "batched");
 
     printf("[display] init OK\n");
   }
@@ -285,29 +517,12 @@ struct OpenglDisplay : Display
 
   void loadModel(int id, String path) override
   {
-    m_Models[id] = ::loadModel(path);
+    m_Models[id] = ::loadModel(path, m_loadTexture);
   }
 
   void setCamera(Vector2f pos) override
   {
-    auto cam = Camera { pos, 0 };
-
-    if(!m_cameraValid)
-    {
-      m_camera = cam;
-      m_cameraValid = true;
-    }
-
-    // avoid big camera jumps
-    {
-      auto delta = m_camera.pos - pos;
-
-      if(abs(delta.x) > 2 || abs(delta.y) > 2)
-        m_camera = cam;
-    }
-
-    m_camera.pos = blend(m_camera.pos, cam.pos, 0.3f);
-    m_camera.angle = cam.angle;
+    m_camera = Camera { pos, 0 };
   }
 
   void setAmbientLight(float ambientLight) override
@@ -319,6 +534,11 @@ struct OpenglDisplay : Display
   {
     m_frameCount++;
     m_quads.clear();
+    m_culledQuads = 0;
+    m_tileLayer.visible = false;
+    m_textCache.endFrame();
+
+    uploadTextures();
   }
 
   void endDraw() override
@@ -330,96 +550,26 @@ struct OpenglDisplay : Display
       SAFE_GL(glViewport((w - size) / 2, (h - size) / 2, size, size));
     }
 
-    SAFE_GL(glUseProgram(m_shader.programId));
-
     SAFE_GL(glClearColor(0, 0, 0, 1));
     SAFE_GL(glClear(GL_COLOR_BUFFER_BIT));
 
-    auto byPriority = [] (Quad const& a, Quad const& b)
-      {
-        if(a.zOrder != b.zOrder)
-          return a.zOrder < b.zOrder;
-
-        if(a.light != b.light)
-          return a.light < b.light;
-
-        return a.texture < b.texture;
-      };
-
-    my::sort<Quad>(m_quads, byPriority);
-
-#define OFFSET(a) \
-  ((GLvoid*)(&((Vertex*)nullptr)->a))
-
-    vector<Vertex> vboData;
+    m_sorter.sort(m_quads);
 
     // Bind our diffuse texture in Texture Unit 0
     SAFE_GL(glActiveTexture(GL_TEXTURE0));
 
-    SAFE_GL(glBindBuffer(GL_ARRAY_BUFFER, m_batchVbo));
-
-    SAFE_GL(glEnableVertexAttribArray(m_shader.positionLoc));
-    SAFE_GL(glVertexAttribPointer(m_shader.positionLoc, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), OFFSET(x)));
-
-    SAFE_GL(glEnableVertexAttribArray(m_shader.texCoordLoc));
-    SAFE_GL(glVertexAttribPointer(m_shader.texCoordLoc, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), OFFSET(u)));
-
-    int drawCalls = 0;
-
-    auto flush = [&] ()
-      {
-        if(vboData.empty())
-          return;
-
-        SAFE_GL(glBufferData(GL_ARRAY_BUFFER, sizeof(vboData[0]) * vboData.size(), vboData.data(), GL_STREAM_DRAW));
-        SAFE_GL(glDrawArrays(GL_TRIANGLES, 0, vboData.size()));
-        vboData.clear();
-        ++drawCalls;
-      };
-
-    GLuint currTexture = -1;
-    std::array<float, 3> currLight {};
-    currLight[0] = 1000;
-
-    for(auto const& q : m_quads)
-    {
-      if(vboData.size() * 6 >= MAX_VERTICES)
-        flush();
-
-      if(q.texture != currTexture)
-      {
-        flush();
-
-        SAFE_GL(glBindTexture(GL_TEXTURE_2D, q.texture));
-        currTexture = q.texture;
-      }
-
-      if(q.light != currLight)
-      {
-        flush();
-
-        SAFE_GL(glUniform4f(m_shader.colorId, q.light[0], q.light[1], q.light[2], 0));
-        currLight = q.light;
-      }
-
-      vboData.push_back({ q.pos[0].x, q.pos[0].y, 0, 0 });
-      vboData.push_back({ q.pos[1].x, q.pos[1].y, 0, 1 });
-      vboData.push_back({ q.pos[2].x, q.pos[2].y, 1, 1 });
-
-      vboData.push_back({ q.pos[0].x, q.pos[0].y, 0, 0 });
-      vboData.push_back({ q.pos[2].x, q.pos[2].y, 1, 1 });
-      vboData.push_back({ q.pos[3].x, q.pos[3].y, 1, 0 });
-    }
+    SAFE_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_quadIndices));
 
-    flush();
+    auto const drawCalls = m_useInstancing ? drawQuadsInstanced() : drawQuadsBatched();
 
     Stat("Draw calls", drawCalls);
+    Stat("Visible quads", m_quads.size());
+    Stat("Culled quads", m_culledQuads);
 
     SAFE_GL(glBindBuffer(GL_ARRAY_BUFFER, 0));
     SAFE_GL(glBindTexture(GL_TEXTURE_2D, 0));
 
     SDL_GL_SwapWindow(m_window);
-#undef OFFSET
   }
 
   void readPixels(Span<uint8_t> dstRgbPixels) override
@@ -444,6 +594,78 @@ struct OpenglDisplay : Display
     }
   }
 
+  // Each call reads the current frame into a pixel buffer object, and
+  // maps the one filled READBACK_BUFFERS - 1 calls ago: by then, the GPU
+  // is done with it, and mapping it doesn't stall the pipeline.
+  bool readPixelsDelayed(Span<uint8_t> dstRgbPixels) override
+  {
+    int width, height;
+    SDL_GetWindowSize(m_window, &width, &height);
+
+#ifdef __EMSCRIPTEN__
+    // WebGL can't map buffers: synchronous fallback
+    SAFE_GL(glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, dstRgbPixels.data));
+    return true;
+#else
+    auto const size = width * height * 4;
+
+    if(size != m_readbackSize)
+    {
+      if(!m_readbackSize)
+        SAFE_GL(glGenBuffers(READBACK_BUFFERS, m_readbackPbos));
+
+      for(auto pbo : m_readbackPbos)
+      {
+        SAFE_GL(glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo));
+        SAFE_GL(glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ));
+      }
+
+      m_readbackSize = size;
+      m_readbackCount = 0;
+      m_readbackPending = 0;
+    }
+
+    SAFE_GL(glBindBuffer(GL_PIXEL_PACK_BUFFER, m_readbackPbos[m_readbackCount % READBACK_BUFFERS]));
+    SAFE_GL(glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr));
+    SAFE_GL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+    ++m_readbackCount;
+    ++m_readbackPending;
+
+    // the oldest one will be overwritten by the next call
+    if(m_readbackPending < READBACK_BUFFERS)
+      return false;
+
+    mapOldestReadback(dstRgbPixels);
+    return true;
+#endif
+  }
+
+  bool flushReadback(Span<uint8_t> dstRgbPixels) override
+  {
+#ifdef __EMSCRIPTEN__
+    (void)dstRgbPixels;
+    return false;
+#else
+    if(!m_readbackPending)
+      return false;
+
+    mapOldestReadback(dstRgbPixels);
+    return true;
+#endif
+  }
+
+  // the OpenGL context can only be current in one thread at a time
+  void detachThread() override
+  {
+    SDL_GL_MakeCurrent(m_window, nullptr);
+  }
+
+  void attachThread() override
+  {
+    if(SDL_GL_MakeCurrent(m_window, m_context))
+      throw Error("Can't make the OpenGL context current");
+  }
+
   void drawActor(Rect2f where, float angle, bool useWorldRefFrame, int modelId, bool blinking, int actionIdx, float ratio, int zOrder) override
   {
     auto& model = m_Models.at(modelId);
@@ -453,94 +675,510 @@ struct OpenglDisplay : Display
 
   void drawText(Vector2f pos, char const* text) override
   {
+    if(auto glyphs = m_textCache.find(pos, text))
+    {
+      auto const light = getQuadLight(m_ambientLight, false, m_frameCount);
+
+      for(auto q : *glyphs)
+      {
+        q.light = light;
+        m_quads.push_back(q);
+      }
+
+      return;
+    }
+
+    auto const first = (int)m_quads.size();
+
     Rect2f rect;
     rect.size.width = 0.5;
     rect.size.height = 0.5;
     rect.pos.x = pos.x - strlen(text) * rect.size.width / 2;
     rect.pos.y = pos.y;
 
-    while(*text)
+    for(auto c = text; *c; ++c)
     {
-      pushQuad(rect, 0, {}, m_fontModel, false, *text, 0, 100);
+      pushQuad(rect, 0, {}, m_fontModel, false, *c, 0, 100);
       rect.pos.x += rect.size.width;
-      ++text;
     }
+
+    m_textCache.add(pos, text, { m_quads.data() + first, (int)m_quads.size() - first });
+  }
+
+  // Builds the mesh of the whole tile layer, in world coordinates.
+  // Tiles are grouped by atlas page, so drawing the layer only costs
+  // one draw call per page, whatever the camera position.
+  void setTileLayer(int modelId, Matrix2<int> const& tiles) override
+  {
+    auto& model = m_Models.at(modelId);
+
+    auto& cells = m_tileLayer.cells;
+    cells.clear();
+
+    auto onCell =
+      [&] (int x, int y, int tile)
+      {
+        if(tile == -1)
+          return;
+
+        if(tile < 0 || tile >= (int)model.actions.size())
+          throw Error("invalid tile index");
+
+        auto const& action = model.actions[tile];
+
+        if(action.textures.empty())
+          throw Error("action has no textures");
+
+        cells.push_back({ x, y, action.textures[0] });
+      };
+
+    tiles.scan(onCell);
+
+    buildTileMesh();
+  }
+
+  // the layer is drawn before the first quad of the same zOrder
+  void drawTileLayer(int zOrder) override
+  {
+    if(m_tileLayer.visible)
+      return;
+
+    m_tileLayer.visible = true;
+    m_tileLayer.zOrder = zOrder;
+    m_tileLayer.light = m_ambientLight;
   }
 
 private:
-  void pushQuad(Rect2f where, float angle, Camera cam, Model const& model, bool blinking, int actionIdx, float ratio, int zOrder)
+  // Returns an index into the atlas regions.
+  // The region shows a transparent placeholder until the picture
+  // is decoded and uploaded.
+  int loadTexture(String path, Rect2f frect)
   {
-    if(model.actions.empty())
-      throw Error("model has no actions");
+    if(!m_placeholderValid)
+    {
+      uint8_t transparent[4] {};
+      m_placeholder = addToAtlas({ Size2i(1, 1), 4, transparent });
+      m_placeholder.ready = false;
+      m_placeholderValid = true;
+    }
 
-    if(actionIdx < 0 || actionIdx >= (int)model.actions.size())
-      throw Error("invalid action index");
+    auto const id = (int)g_atlas.regions.size();
+    g_atlas.regions.push_back(m_placeholder);
+    m_pictureLoader.request(id, path, frect);
+    return id;
+  }
 
-    auto const& action = model.actions[actionIdx];
+#ifndef __EMSCRIPTEN__
+  void mapOldestReadback(Span<uint8_t> dstRgbPixels)
+  {
+    auto const pbo = m_readbackPbos[(m_readbackCount - m_readbackPending) % READBACK_BUFFERS];
+    --m_readbackPending;
 
-    if(action.textures.empty())
-      throw Error("action has no textures");
+    SAFE_GL(glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo));
+    auto src = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, m_readbackSize, GL_MAP_READ_BIT);
 
-    auto const N = (int)action.textures.size();
-    auto const idx = ::clamp<int>(ratio * N, 0, N - 1);
+    if(!src)
+      throw Error("Can't map the readback buffer");
 
-    if(where.size.width < 0)
-      where.pos.x -= where.size.width;
+    memcpy(dstRgbPixels.data, src, min(m_readbackSize, dstRgbPixels.len));
+    SAFE_GL(glUnmapBuffer(GL_PIXEL_PACK_BUFFER));
+    SAFE_GL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+  }
+#endif
 
-    if(where.size.height < 0)
-      where.pos.y -= where.size.height;
+  // Uploads the decoded pictures to the atlas, within a per-frame budget,
+  // so a burst of loads is spread over several frames.
+  void uploadTextures()
+  {
+    int uploadedSize = 0;
+    int id;
+    Picture pic;
 
-    auto const relPos = where.pos - cam.pos;
+    while(uploadedSize < UPLOAD_BUDGET && m_pictureLoader.poll(id, pic))
+    {
+      g_atlas.regions.at(id) = addToAtlas(pic);
+      uploadedSize += pic.dim.width * pic.dim.height * 4;
+    }
 
-    auto const sx = where.size.width;
-    auto const sy = where.size.height;
+    Stat("Pending textures", m_pictureLoader.pendingCount());
 
-    auto mat = scale(Vector2f(sx, sy));
-    mat = rotate(angle) * mat;
-    mat = translate(relPos) * mat;
-    mat = rotate(-cam.angle) * mat;
+    if(uploadedSize == 0)
+      return;
 
-    auto shrink = scale(0.125 * Vector2f(1, 1));
-    mat = shrink * mat;
+    // the cached glyphs and the tile mesh might still use the placeholder
+    m_textCache.clear();
 
-    Quad q;
-    q.zOrder = zOrder;
-    q.texture = action.textures[idx];
+    if(m_tileLayer.waiting)
+      buildTileMesh();
+  }
 
-    auto const m0x = 0;
-    auto const m0y = 0;
-    auto const m1x = 1;
-    auto const m1y = 1;
+  // (Re)builds the mesh of the tile layer, from its cells.
+  void buildTileMesh()
+  {
+    auto& cells = m_tileLayer.cells;
+
+    auto byTexture =
+      [] (TileLayer::Cell const& a, TileLayer::Cell const& b)
+      {
+        return g_atlas.regions[a.region].texture < g_atlas.regions[b.region].texture;
+      };
 
-    q.pos[0].x = mat[0][0] * m0x + mat[0][1] * m0y + mat[0][2];
-    q.pos[0].y = mat[1][0] * m0x + mat[1][1] * m0y + mat[1][2];
+    stable_sort(cells.begin(), cells.end(), byTexture);
 
-    q.pos[1].x = mat[0][0] * m0x + mat[0][1] * m1y + mat[0][2];
-    q.pos[1].y = mat[1][0] * m0x + mat[1][1] * m1y + mat[1][2];
+    m_tileLayer.waiting = false;
 
-    q.pos[2].x = mat[0][0] * m1x + mat[0][1] * m1y + mat[0][2];
-    q.pos[2].y = mat[1][0] * m1x + mat[1][1] * m1y + mat[1][2];
+    vector<TileVertex> vertices;
+    vector<uint32_t> indices;
+    vertices.reserve(cells.size() * 4);
+    indices.reserve(cells.size() * 6);
 
-    q.pos[3].x = mat[0][0] * m1x + mat[0][1] * m0y + mat[0][2];
-    q.pos[3].y = mat[1][0] * m1x + mat[1][1] * m0y + mat[1][2];
+    m_tileLayer.ranges.clear();
 
-    // lighting
+    for(auto& cell : cells)
     {
-      q.light[0] = m_ambientLight;
-      q.light[1] = m_ambientLight;
-      q.light[2] = m_ambientLight;
+      auto const& region = g_atlas.regions[cell.region];
+      auto const texture = region.texture;
+
+      if(!region.ready)
+        m_tileLayer.waiting = true;
+
+      if(m_tileLayer.ranges.empty() || m_tileLayer.ranges.back().texture != texture)
+        m_tileLayer.ranges.push_back({ texture, (int)indices.size(), 0 });
+
+      auto const& uv = region.uv;
+      auto const u0 = toUnorm16(uv.pos.x);
+      auto const v0 = toUnorm16(uv.pos.y);
+      auto const u1 = toUnorm16(uv.pos.x + uv.size.width);
+      auto const v1 = toUnorm16(uv.pos.y + uv.size.height);
+
+      auto const x = float(cell.x);
+      auto const y = float(cell.y);
+
+      auto const base = uint32_t(vertices.size());
+      vertices.push_back({ x + 0, y + 0, u0, v0 });
+      vertices.push_back({ x + 0, y + 1, u0, v1 });
+      vertices.push_back({ x + 1, y + 1, u1, v1 });
+      vertices.push_back({ x + 1, y + 0, u1, v0 });
+
+      for(auto i : { 0, 1, 2, 0, 2, 3 })
+        indices.push_back(base + i);
+
+      m_tileLayer.ranges.back().count += 6;
+    }
+
+    if(!m_tileLayer.vertexArray)
+    {
+      SAFE_GL(glGenVertexArrays(1, &m_tileLayer.vertexArray));
+      SAFE_GL(glGenBuffers(1, &m_tileLayer.vbo));
+      SAFE_GL(glGenBuffers(1, &m_tileLayer.ibo));
+    }
+
+    SAFE_GL(glBindVertexArray(m_tileLayer.vertexArray));
+
+    SAFE_GL(glBindBuffer(GL_ARRAY_BUFFER, m_tileLayer.vbo));
+    SAFE_GL(glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(TileVertex), vertices.data(), GL_STATIC_DRAW));
+
+    SAFE_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_tileLayer.ibo));
+    SAFE_GL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW));
+
+    SAFE_GL(glEnableVertexAttribArray(m_shader.positionLoc));
+    SAFE_GL(glVertexAttribPointer(m_shader.positionLoc, 2, GL_FLOAT, GL_FALSE, sizeof(TileVertex), (GLvoid*)offsetof(TileVertex, x)));
+
+    SAFE_GL(glEnableVertexAttribArray(m_shader.texCoordLoc));
+    SAFE_GL(glVertexAttribPointer(m_shader.texCoordLoc, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(TileVertex), (GLvoid*)offsetof(TileVertex, u)));
+
+    SAFE_GL(glBindVertexArray(m_vertexArray));
+    SAFE_GL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+  }
 
-      if(blinking)
+  // Draws the whole tile layer, for the current frame.
+  // Leaves the main vertex array bound, but not the program nor the texture.
+  // Returns the number of draw calls.
+  int drawTileMesh()
+  {
+    m_tileLayer.visible = false;
+
+    // the camera never rotates, so the view transform is a translation
+    auto const& cam = m_camera.pos;
+
+    SAFE_GL(glUseProgram(m_shader.programId));
+    SAFE_GL(glUniform2f(m_shader.offsetId, -cam.x, -cam.y));
+    SAFE_GL(glUniform1f(m_shader.scaleId, 0.125));
+
+    SAFE_GL(glBindVertexArray(m_tileLayer.vertexArray));
+
+    // the light attribute has no array here: it's the same for the whole mesh
+    auto const light = m_tileLayer.light;
+    SAFE_GL(glVertexAttrib3f(m_shader.lightLoc, light, light, light));
+
+    for(auto& range : m_tileLayer.ranges)
+    {
+      SAFE_GL(glBindTexture(GL_TEXTURE_2D, range.texture));
+      SAFE_GL(glDrawElements(GL_TRIANGLES, range.count, GL_UNSIGNED_INT, (GLvoid*)(range.firstIndex * sizeof(uint32_t))));
+    }
+
+    SAFE_GL(glBindVertexArray(m_vertexArray));
+    SAFE_GL(glUniform2f(m_shader.offsetId, 0, 0));
+    SAFE_GL(glUniform1f(m_shader.scaleId, 1));
+
+    return (int)m_tileLayer.ranges.size();
+  }
+
+  // Fallback path: the CPU transforms the 4 corners of each quad.
+  // Lighting is per-vertex, so only texture changes break batches.
+  // Returns the number of draw calls.
+  int drawQuadsBatched()
+  {
+#define OFFSET(a) \
+  ((GLvoid*)(&((Vertex*)nullptr)->a))
+
+    // all the corners at once
+    m_quadBatch.assign(m_quads);
+    m_corners.resize(m_quads.size() * 4);
+    computeCorners(m_quadBatch, m_corners);
+
+    SAFE_GL(glUseProgram(m_shader.programId));
+
+    SAFE_GL(glBindBuffer(GL_ARRAY_BUFFER, m_batchRing.vbo()));
+
+    SAFE_GL(glEnableVertexAttribArray(m_shader.positionLoc));
+    SAFE_GL(glVertexAttribPointer(m_shader.positionLoc, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), OFFSET(x)));
+
+    SAFE_GL(glEnableVertexAttribArray(m_shader.texCoordLoc));
+    SAFE_GL(glVertexAttribPointer(m_shader.texCoordLoc, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(Vertex), OFFSET(u)));
+
+    SAFE_GL(glEnableVertexAttribArray(m_shader.lightLoc));
+    SAFE_GL(glVertexAttribPointer(m_shader.lightLoc, 3, GL_BYTE, GL_TRUE, sizeof(Vertex), OFFSET(light)));
+
+#undef OFFSET
+
+    int drawCalls = 0;
+
+    auto flush = [&] ()
+      {
+        auto const count = m_batchRing.pendingCount();
+
+        if(count == 0)
+          return;
+
+        // the vertices of a quad are contiguous, so are its indices
+        auto const firstQuad = m_batchRing.commit() / 4;
+        auto const indexOffset = (GLvoid*)(firstQuad * 6 * sizeof(uint16_t));
+        SAFE_GL(glDrawElements(GL_TRIANGLES, count / 4 * 6, GL_UNSIGNED_SHORT, indexOffset));
+        ++drawCalls;
+      };
+
+    GLuint currTexture = -1;
+
+    auto drawTiles =
+      [&] (int zOrder)
       {
-        if((m_frameCount / 4) % 2)
-        {
-          q.light[0] = 0.8;
-          q.light[1] = 0.4;
-          q.light[2] = 0.4;
-        }
+        if(!m_tileLayer.visible || zOrder < m_tileLayer.zOrder)
+          return;
+
+        flush();
+        drawCalls += drawTileMesh();
+
+        SAFE_GL(glBindBuffer(GL_ARRAY_BUFFER, m_batchRing.vbo()));
+        currTexture = -1;
+      };
+
+    for(auto i : m_sorter.order)
+    {
+      auto const& q = m_quads[i];
+
+      drawTiles(q.zOrder);
+
+      if(q.texture != currTexture)
+      {
+        flush();
+
+        SAFE_GL(glBindTexture(GL_TEXTURE_2D, q.texture));
+        currTexture = q.texture;
+      }
+
+      auto const u0 = toUnorm16(q.uv.pos.x);
+      auto const v0 = toUnorm16(q.uv.pos.y);
+      auto const u1 = toUnorm16(q.uv.pos.x + q.uv.size.width);
+      auto const v1 = toUnorm16(q.uv.pos.y + q.uv.size.height);
+
+      auto vertices = m_batchRing.allocate(4);
+
+      // the ring buffer is full
+      if(!vertices)
+      {
+        flush();
+        vertices = m_batchRing.allocate(4);
+      }
+
+      auto const corners = &m_corners[i * 4];
+      auto const light = toSnorm8(q.light);
+
+      vertices[0] = { corners[0].x, corners[0].y, u0, v0, light };
+      vertices[1] = { corners[1].x, corners[1].y, u0, v1, light };
+      vertices[2] = { corners[2].x, corners[2].y, u1, v1, light };
+      vertices[3] = { corners[3].x, corners[3].y, u1, v0, light };
+    }
+
+    flush();
+    drawTiles(INT_MAX);
+
+    return drawCalls;
+  }
+
+  void initInstancing()
+  {
+    auto& shader = m_instancedShader;
+    shader.programId = loadShaders(InstancedVertexShaderCode);
+
+    shader.cornerLoc = glGetAttribLocation(shader.programId, "corner");
+    shader.posLoc = glGetAttribLocation(shader.programId, "instancePos");
+    shader.sizeLoc = glGetAttribLocation(shader.programId, "instanceSize");
+    shader.angleLoc = glGetAttribLocation(shader.programId, "instanceAngle");
+    shader.uvLoc = glGetAttribLocation(shader.programId, "instanceUV");
+    shader.lightLoc = glGetAttribLocation(shader.programId, "instanceLight");
+
+    assert(shader.cornerLoc >= 0);
+    assert(shader.posLoc >= 0);
+    assert(shader.sizeLoc >= 0);
+    assert(shader.angleLoc >= 0);
+    assert(shader.uvLoc >= 0);
+    assert(shader.lightLoc >= 0);
+
+    // the unit quad, expanded by the vertex shader
+    static const float corners[] = { 0, 0, 0, 1, 1, 1, 1, 0 };
+    SAFE_GL(glGenBuffers(1, &m_unitQuadVbo));
+    SAFE_GL(glBindBuffer(GL_ARRAY_BUFFER, m_unitQuadVbo));
+    SAFE_GL(glBufferData(GL_ARRAY_BUFFER, sizeof corners, corners, GL_STATIC_DRAW));
+    SAFE_GL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+
+    m_instanceRing.init(MAX_VERTICES / 4);
+  }
+
+  // The CPU only copies the quad parameters, the vertex shader does the rest.
+  // Lighting is per-instance, so only texture changes break batches.
+  // Returns the number of draw calls.
+  int drawQuadsInstanced()
+  {
+    auto& shader = m_instancedShader;
+
+    SAFE_GL(glUseProgram(shader.programId));
+
+    SAFE_GL(glBindBuffer(GL_ARRAY_BUFFER, m_unitQuadVbo));
+    SAFE_GL(glEnableVertexAttribArray(shader.cornerLoc));
+    SAFE_GL(glVertexAttribPointer(shader.cornerLoc, 2, GL_FLOAT, GL_FALSE, 0, nullptr));
+
+    SAFE_GL(glBindBuffer(GL_ARRAY_BUFFER, m_instanceRing.vbo()));
+
+    int drawCalls = 0;
+
+    auto flush = [&] ()
+      {
+        auto const count = m_instanceRing.pendingCount();
+
+        if(count == 0)
+          return;
+
+        auto const first = m_instanceRing.commit();
+
+        // OpenGL ES 3.0 has no 'base instance': point the attributes
+        // to the first instance of the batch.
+        auto const base = first * sizeof(Instance);
+
+        auto setAttrib = [&] (GLint loc, int size, GLenum type, GLboolean normalized, size_t offset)
+          {
+            SAFE_GL(glEnableVertexAttribArray(loc));
+            SAFE_GL(glVertexAttribPointer(loc, size, type, normalized, sizeof(Instance), (GLvoid*)(base + offset)));
+            SAFE_GL(glVertexAttribDivisor(loc, 1));
+          };
+
+        setAttrib(shader.posLoc, 2, GL_FLOAT, GL_FALSE, offsetof(Instance, x));
+        setAttrib(shader.sizeLoc, 2, GL_FLOAT, GL_FALSE, offsetof(Instance, width));
+        setAttrib(shader.angleLoc, 1, GL_FLOAT, GL_FALSE, offsetof(Instance, angle));
+        setAttrib(shader.uvLoc, 4, GL_UNSIGNED_SHORT, GL_TRUE, offsetof(Instance, uv));
+        setAttrib(shader.lightLoc, 3, GL_FLOAT, GL_FALSE, offsetof(Instance, light));
+
+        SAFE_GL(glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, nullptr, count));
+        ++drawCalls;
+      };
+
+    GLuint currTexture = -1;
+
+    auto drawTiles =
+      [&] (int zOrder)
+      {
+        if(!m_tileLayer.visible || zOrder < m_tileLayer.zOrder)
+          return;
+
+        flush();
+        drawCalls += drawTileMesh();
+
+        SAFE_GL(glUseProgram(shader.programId));
+        SAFE_GL(glBindBuffer(GL_ARRAY_BUFFER, m_instanceRing.vbo()));
+        currTexture = -1;
+      };
+
+    for(auto i : m_sorter.order)
+    {
+      auto const& q = m_quads[i];
+
+      drawTiles(q.zOrder);
+
+      if(q.texture != currTexture)
+      {
+        flush();
+
+        SAFE_GL(glBindTexture(GL_TEXTURE_2D, q.texture));
+        currTexture = q.texture;
+      }
+
+      auto instance = m_instanceRing.allocate(1);
+
+      // the ring buffer is full
+      if(!instance)
+      {
+        flush();
+        instance = m_instanceRing.allocate(1);
       }
+
+      instance->x = q.pos.x;
+      instance->y = q.pos.y;
+      instance->width = q.size.width;
+      instance->height = q.size.height;
+      instance->angle = q.angle;
+      instance->uv[0] = toUnorm16(q.uv.pos.x);
+      instance->uv[1] = toUnorm16(q.uv.pos.y);
+      instance->uv[2] = toUnorm16(q.uv.pos.x + q.uv.size.width);
+      instance->uv[3] = toUnorm16(q.uv.pos.y + q.uv.size.height);
+      instance->light[0] = q.light[0];
+      instance->light[1] = q.light[1];
+      instance->light[2] = q.light[2];
     }
 
+    flush();
+    drawTiles(INT_MAX);
+
+    return drawCalls;
+  }
+
+  void pushQuad(Rect2f where, float angle, Camera cam, Model const& model, bool blinking, int actionIdx, float ratio, int zOrder)
+  {
+    auto const& region = g_atlas.regions.at(getFrameTexture(model, actionIdx, ratio));
+
+    Quad q;
+    q.zOrder = zOrder;
+    q.texture = region.texture;
+    q.uv = region.uv;
+    placeQuad(q, where, angle, cam);
+
+    if(!isVisible(q))
+    {
+      ++m_culledQuads;
+      return;
+    }
+
+    q.light = getQuadLight(m_ambientLight, blinking, m_frameCount);
+
     m_quads.push_back(q);
   }
 
@@ -548,40 +1186,107 @@ private:
   SDL_GLContext m_context;
 
   Camera m_camera;
-  bool m_cameraValid = false;
 
   // shader attribute/uniform locations
   struct Shader
   {
     GLuint programId;
-    GLint colorId;
     GLint positionLoc;
     GLint texCoordLoc;
+    GLint lightLoc;
+    GLint offsetId;
+    GLint scaleId;
   };
 
   Shader m_shader;
 
-  struct Quad
+  struct InstancedShader
   {
-    int zOrder;
-    std::array<float, 3> light {};
-    GLuint texture;
-    Vector2f pos[4];
+    GLuint programId;
+    GLint cornerLoc;
+    GLint posLoc;
+    GLint sizeLoc;
+    GLint angleLoc;
+    GLint uvLoc;
+    GLint lightLoc;
   };
 
+  InstancedShader m_instancedShader;
+  bool m_useInstancing = false;
+
   vector<Quad> m_quads;
-  GLuint m_batchVbo;
+  int m_culledQuads = 0; // current frame
+  QuadSorter m_sorter;
+  QuadBatch m_quadBatch;
+  vector<Vector2f> m_corners; // 4 per quad, for the batched path
+  StreamRing<Vertex> m_batchRing;
+  StreamRing<Instance> m_instanceRing;
+  GLuint m_quadIndices;
+  GLuint m_unitQuadVbo = 0;
+  GLuint m_vertexArray = 0;
+
+  // static mesh, rebuilt by 'setTileLayer'
+  struct TileLayer
+  {
+    struct Cell
+    {
+      int x, y;
+      int region; // index into the atlas regions
+    };
+
+    vector<Cell> cells;
+    bool waiting = false; // some cells still use the placeholder
+
+    struct Range
+    {
+      GLuint texture;
+      int firstIndex;
+      int count;
+    };
+
+    GLuint vertexArray = 0;
+    GLuint vbo = 0;
+    GLuint ibo = 0; // 32-bit indices: a room can have more than 16k tiles
+    vector<Range> ranges; // one per atlas page
+
+    // current frame
+    bool visible = false;
+    int zOrder = 0;
+    float light = 0;
+  };
+
+  TileLayer m_tileLayer;
 
   unordered_map<int, Model> m_Models;
   Model m_fontModel;
+  TextCache m_textCache;
+
+  // asynchronous texture loading
+  static auto const UPLOAD_BUDGET = 1024 * 1024; // in bytes, per frame
+  TextureLoader m_loadTexture;
+  PictureLoader m_pictureLoader { PICTURE_LOADER_THREADS };
+  TextureRegion m_placeholder;
+  bool m_placeholderValid = false;
+
+  // asynchronous readback
+  static auto const READBACK_BUFFERS = 3;
+  GLuint m_readbackPbos[READBACK_BUFFERS] {};
+  int m_readbackSize = 0; // in bytes, 0 if not allocated yet
+  int m_readbackCount = 0; // number of frames read back so far
+  int m_readbackPending = 0; // number of frames read back, but not returned yet
 
   float m_ambientLight = 0;
   int m_frameCount = 0;
 };
 }
 
-Display* createDisplay(Size2i resolution)
+Display* createSoftwareDisplay(Size2i resolution);
+
+Display* createDisplay(Size2i resolution, bool headless)
 {
+  if(headless)
+    return createSoftwareDisplay(resolution);
+
   return new OpenglDisplay(resolution);
 }
 
@@ -155,10 +155,22 @@ private:
     m_wheelDelegate(evt->wheel.y);
   }
 };
+
+// no window: there are no events to listen to
+struct NullUserInput : UserInput
+{
+  void process() override {}
+  void listenToKey(Key, Delegate<void(bool)>, bool, bool) override {}
+  void listenToQuit(Delegate<void()>) override {}
+  void listenToMouseWheel(Delegate<void(int)>) override {}
+};
 }
 
-UserInput* createUserInput()
+UserInput* createUserInput(bool headless)
 {
+  if(headless)
+    return new NullUserInput;
+
   return new SdlUserInput();
 }
 
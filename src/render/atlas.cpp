@@ -0,0 +1,84 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+#include "atlas.h"
+
+#include "base/error.h"
+
+Atlas::Atlas(Size2i pageSize) : m_pageSize(pageSize)
+{
+}
+
+Atlas::Slot Atlas::allocate(Size2i size)
+{
+  if(size.width > m_pageSize.width || size.height > m_pageSize.height)
+    throw Error("Rectangle is too big for the atlas page");
+
+  Slot r;
+
+  for(int i = 0; i < (int)m_pages.size(); ++i)
+  {
+    if(allocateInPage(m_pages[i], size, r.rect.pos))
+    {
+      r.page = i;
+      r.rect.size = size;
+      return r;
+    }
+  }
+
+  m_pages.push_back({});
+
+  if(!allocateInPage(m_pages.back(), size, r.rect.pos))
+    throw Error("Can't allocate in an empty atlas page");
+
+  r.page = (int)m_pages.size() - 1;
+  r.rect.size = size;
+  return r;
+}
+
+int Atlas::pageCount() const
+{
+  return (int)m_pages.size();
+}
+
+bool Atlas::allocateInPage(Page& page, Size2i size, Vector2i& pos)
+{
+  // best fit: the lowest shelf that has enough room
+  Shelf* best = nullptr;
+
+  for(auto& shelf : page.shelves)
+  {
+    if(shelf.height < size.height)
+      continue;
+
+    if(shelf.usedWidth + size.width > m_pageSize.width)
+      continue;
+
+    if(!best || shelf.height < best->height)
+      best = &shelf;
+  }
+
+  // don't waste a tall shelf on a small rectangle, if we can open a new one
+  auto const canOpenShelf = page.usedHeight + size.height <= m_pageSize.height;
+
+  if(best && best->height > size.height * 2 && canOpenShelf)
+    best = nullptr;
+
+  if(!best)
+  {
+    if(!canOpenShelf)
+      return false;
+
+    page.shelves.push_back({ page.usedHeight, size.height, 0 });
+    page.usedHeight += size.height;
+    best = &page.shelves.back();
+  }
+
+  pos.x = best->usedWidth;
+  pos.y = best->y;
+  best->usedWidth += size.width;
+  return true;
+}
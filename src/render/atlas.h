@@ -0,0 +1,50 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+// Texture atlas allocator: packs rectangles into fixed-size pages,
+// using horizontal shelves. Only does the bookkeeping, no pixels here.
+
+#pragma once
+
+#include <vector>
+
+#include "base/geom.h"
+
+struct Atlas
+{
+  Atlas(Size2i pageSize);
+
+  struct Slot
+  {
+    int page;
+    Rect2i rect;
+  };
+
+  // opens a new page if needed.
+  // 'size' must fit in a page.
+  Slot allocate(Size2i size);
+
+  int pageCount() const;
+
+private:
+  struct Shelf
+  {
+    int y;
+    int height;
+    int usedWidth;
+  };
+
+  struct Page
+  {
+    std::vector<Shelf> shelves;
+    int usedHeight = 0;
+  };
+
+  bool allocateInPage(Page& page, Size2i size, Vector2i& pos);
+
+  Size2i const m_pageSize;
+  std::vector<Page> m_pages;
+};
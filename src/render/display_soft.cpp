@@ -0,0 +1,318 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+// Headless display: draws the same sorted quads as the OpenGL display,
+// using the CPU rasterizer. Doesn't need a window nor a GPU.
+
+#include <climits> // INT_MAX
+#include <cstdio>
+#include <cstring> // memcpy, strlen
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+#include "base/error.h"
+#include "base/geom.h"
+#include "base/span.h"
+#include "engine/display.h"
+#include "engine/stats.h"
+#include "model.h"
+#include "picture.h"
+#include "quad.h"
+#include "rasterizer.h"
+#include "text_cache.h"
+
+namespace
+{
+struct SoftwareDisplay : Display
+{
+  SoftwareDisplay(Size2i resolution)
+  {
+    m_framebuffer.resize(resolution);
+
+    m_loadTexture = [this] (String path, Rect2f rect) { return loadTexture(path, rect); };
+    m_fontModel = ::loadModel("res/font.model", m_loadTexture);
+
+    printf("[display] using software rendering, %dx%d\n", resolution.width, resolution.height);
+  }
+
+  void setFullscreen(bool) override {}
+  void setCaption(const char*) override {}
+
+  void loadModel(int id, String path) override
+  {
+    m_models[id] = ::loadModel(path, m_loadTexture);
+  }
+
+  void setCamera(Vector2f pos) override
+  {
+    m_camera = Camera { pos, 0 };
+  }
+
+  void setAmbientLight(float ambientLight) override
+  {
+    m_ambientLight = ambientLight;
+  }
+
+  void beginDraw() override
+  {
+    m_frameCount++;
+    m_quads.clear();
+    m_culledQuads = 0;
+    m_tileLayer.visible = false;
+    m_textCache.endFrame();
+  }
+
+  void endDraw() override
+  {
+    m_framebuffer.clear(0, 0, 0, 255);
+
+    m_sorter.sort(m_quads);
+    computeAllCorners(m_quads, m_corners);
+
+    auto drawTiles =
+      [&] (int zOrder)
+      {
+        if(!m_tileLayer.visible || zOrder < m_tileLayer.zOrder)
+          return;
+
+        m_tileLayer.visible = false;
+        drawTileLayerNow();
+      };
+
+    for(auto i : m_sorter.order)
+    {
+      auto const& q = m_quads[i];
+      drawTiles(q.zOrder);
+      rasterize(q, &m_corners[i * 4]);
+    }
+
+    drawTiles(INT_MAX);
+
+    Stat("Visible quads", m_quads.size());
+    Stat("Culled quads", m_culledQuads);
+  }
+
+  void drawActor(Rect2f where, float angle, bool useWorldRefFrame, int modelId, bool blinking, int actionIdx, float ratio, int zOrder) override
+  {
+    auto& model = m_models.at(modelId);
+    auto cam = useWorldRefFrame ? m_camera : Camera();
+    pushQuad(where, angle, cam, model, blinking, actionIdx, ratio, zOrder);
+  }
+
+  void drawText(Vector2f pos, char const* text) override
+  {
+    if(auto glyphs = m_textCache.find(pos, text))
+    {
+      auto const light = getQuadLight(m_ambientLight, false, m_frameCount);
+
+      for(auto q : *glyphs)
+      {
+        q.light = light;
+        m_quads.push_back(q);
+      }
+
+      return;
+    }
+
+    auto const first = (int)m_quads.size();
+
+    Rect2f rect;
+    rect.size.width = 0.5;
+    rect.size.height = 0.5;
+    rect.pos.x = pos.x - strlen(text) * rect.size.width / 2;
+    rect.pos.y = pos.y;
+
+    for(auto c = text; *c; ++c)
+    {
+      pushQuad(rect, 0, {}, m_fontModel, false, *c, 0, 100);
+      rect.pos.x += rect.size.width;
+    }
+
+    m_textCache.add(pos, text, { m_quads.data() + first, (int)m_quads.size() - first });
+  }
+
+  void setTileLayer(int modelId, Matrix2<int> const& tiles) override
+  {
+    auto& model = m_models.at(modelId);
+
+    m_tileLayer.tiles.clear();
+
+    auto onCell =
+      [&] (int x, int y, int tile)
+      {
+        if(tile == -1)
+          return;
+
+        m_tileLayer.tiles.push_back({ Vector2f(x, y), getFrameTexture(model, tile, 0) });
+      };
+
+    tiles.scan(onCell);
+  }
+
+  void drawTileLayer(int zOrder) override
+  {
+    if(m_tileLayer.visible)
+      return;
+
+    m_tileLayer.visible = true;
+    m_tileLayer.zOrder = zOrder;
+    m_tileLayer.light = m_ambientLight;
+  }
+
+  void readPixels(Span<uint8_t> dstRgbPixels) override
+  {
+    auto const& pixels = m_framebuffer.pixels;
+    memcpy(dstRgbPixels.data, pixels.data(), min((int)pixels.size(), dstRgbPixels.len));
+  }
+
+  // nothing to wait for here: just flip the rows, like OpenGL
+  bool readPixelsDelayed(Span<uint8_t> dstRgbPixels) override
+  {
+    auto const rowSize = m_framebuffer.dim.width * 4;
+    auto const height = m_framebuffer.dim.height;
+
+    for(int row = 0; row < height && (row + 1) * rowSize <= dstRgbPixels.len; ++row)
+      memcpy(dstRgbPixels.data + row * rowSize, &m_framebuffer.pixels[(height - 1 - row) * rowSize], rowSize);
+
+    return true;
+  }
+
+  bool flushReadback(Span<uint8_t>) override
+  {
+    return false;
+  }
+
+  // no rendering context: any thread can draw
+  void detachThread() override {}
+  void attachThread() override {}
+
+private:
+  int loadTexture(String path, Rect2f rect)
+  {
+    m_textures.push_back(loadPicture(path, rect));
+    return (int)m_textures.size() - 1;
+  }
+
+  void pushQuad(Rect2f where, float angle, Camera cam, Model const& model, bool blinking, int actionIdx, float ratio, int zOrder)
+  {
+    Quad q;
+    q.zOrder = zOrder;
+    q.texture = getFrameTexture(model, actionIdx, ratio);
+    q.uv = Rect2f(0, 0, 1, 1);
+    placeQuad(q, where, angle, cam);
+
+    if(!isVisible(q))
+    {
+      ++m_culledQuads;
+      return;
+    }
+
+    q.light = getQuadLight(m_ambientLight, blinking, m_frameCount);
+
+    m_quads.push_back(q);
+  }
+
+  void drawTileLayerNow()
+  {
+    auto const light = m_tileLayer.light;
+
+    m_tileQuads.clear();
+
+    for(auto& tile : m_tileLayer.tiles)
+    {
+      Quad q;
+      q.texture = tile.texture;
+      q.uv = Rect2f(0, 0, 1, 1);
+      q.light = { light, light, light };
+      placeQuad(q, Rect2f(tile.pos.x, tile.pos.y, 1, 1), 0, m_camera);
+
+      if(isVisible(q))
+        m_tileQuads.push_back(q);
+    }
+
+    computeAllCorners(m_tileQuads, m_tileCorners);
+
+    for(int i = 0; i < (int)m_tileQuads.size(); ++i)
+      rasterize(m_tileQuads[i], &m_tileCorners[i * 4]);
+  }
+
+  void computeAllCorners(vector<Quad> const& quads, vector<Vector2f>& corners)
+  {
+    m_quadBatch.assign(quads);
+    corners.resize(quads.size() * 4);
+    computeCorners(m_quadBatch, corners);
+  }
+
+  // 'corners' are in clip space, and get modified
+  void rasterize(Quad const& q, Vector2f* corners)
+  {
+    // the square viewport of the OpenGL display
+    auto const dim = m_framebuffer.dim;
+    auto const size = min(dim.width, dim.height);
+    auto const left = (dim.width - size) / 2;
+    auto const top = dim.height - (dim.height - size) / 2 - size;
+
+    // clip space to pixels, with top-down rows
+    for(int k = 0; k < 4; ++k)
+    {
+      auto& c = corners[k];
+      c.x = left + (c.x + 1) * 0.5f * size;
+      c.y = top + (1 - c.y) * 0.5f * size;
+    }
+
+    auto& pic = m_textures[q.texture];
+    auto const texture = PictureView { pic.dim, pic.dim.width * 4, pic.pixels.data() };
+
+    drawTexturedQuad(m_framebuffer, Rect2i(left, top, size, size), corners, texture, q.uv, q.light);
+  }
+
+  Framebuffer m_framebuffer;
+
+  Camera m_camera;
+
+  vector<Picture> m_textures;
+  TextureLoader m_loadTexture;
+
+  vector<Quad> m_quads;
+  int m_culledQuads = 0; // current frame
+  QuadSorter m_sorter;
+  QuadBatch m_quadBatch;
+  vector<Vector2f> m_corners; // 4 per quad
+
+  struct TileLayer
+  {
+    struct Tile
+    {
+      Vector2f pos; // world coordinates
+      int texture;
+    };
+
+    vector<Tile> tiles;
+
+    // current frame
+    bool visible = false;
+    int zOrder = 0;
+    float light = 0;
+  };
+
+  TileLayer m_tileLayer;
+  vector<Quad> m_tileQuads; // visible tiles, current frame
+  vector<Vector2f> m_tileCorners;
+
+  unordered_map<int, Model> m_models;
+  Model m_fontModel;
+  TextCache m_textCache;
+
+  float m_ambientLight = 0;
+  int m_frameCount = 0;
+};
+}
+
+Display* createSoftwareDisplay(Size2i resolution)
+{
+  return new SoftwareDisplay(resolution);
+}
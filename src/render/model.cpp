@@ -7,21 +7,20 @@
 #include "base/error.h"
 #include "base/geom.h"
 #include "base/string.h"
+#include "base/util.h" // clamp
 #include "misc/file.h"
 #include "misc/json.h"
 #include "misc/util.h" // dirName
 #include "model.h"
 
-extern int loadTexture(String path, Rect2f rect);
-
 static
-void addTexture(Action& action, String path, Rect2f rect)
+void addTexture(TextureLoader const& loadTexture, Action& action, String path, Rect2f rect)
 {
   action.textures.push_back(loadTexture(path, rect));
 }
 
 static
-Action loadSheetAction(json::Value const& action, string sheetPath, int ROWS, int COLS)
+Action loadSheetAction(TextureLoader const& loadTexture, json::Value const& action, string sheetPath, int ROWS, int COLS)
 {
   Action r;
 
@@ -38,14 +37,14 @@ Action loadSheetAction(json::Value const& action, string sheetPath, int ROWS, in
     rect.pos.y = row / float(ROWS);
     rect.size.width = 1.0 / float(COLS);
     rect.size.height = 1.0 / float(ROWS);
-    addTexture(r, sheetPath, rect);
+    addTexture(loadTexture, r, sheetPath, rect);
   }
 
   return r;
 }
 
 static
-Model loadAnimatedModel(String jsonPath)
+Model loadAnimatedModel(TextureLoader const& loadTexture, String jsonPath)
 {
   auto data = File::read(jsonPath);
   Model r;
@@ -61,7 +60,7 @@ Model loadAnimatedModel(String jsonPath)
     std::string sheet = setExtension(jsonPath, "png");
 
     for(auto& action : obj["actions"].elements)
-      r.actions.push_back(loadSheetAction(action, sheet, rows, cols));
+      r.actions.push_back(loadSheetAction(loadTexture, action, sheet, rows, cols));
   }
   else if(type == "tiled")
   {
@@ -78,7 +77,7 @@ Model loadAnimatedModel(String jsonPath)
         rect.size.width = 1.0 / float(cols);
         rect.size.height = 1.0 / float(rows);
 
-        addTexture(action, (string(dir.data, dir.len) + "/" + sheet), rect);
+        addTexture(loadTexture, action, (string(dir.data, dir.len) + "/" + sheet), rect);
         r.actions.push_back(action);
       }
     }
@@ -90,7 +89,7 @@ Model loadAnimatedModel(String jsonPath)
 }
 
 static
-Model loadTiledModel(String path, int count, int COLS, int ROWS)
+Model loadTiledModel(TextureLoader const& loadTexture, String path, int count, int COLS, int ROWS)
 {
   auto m = Model();
 
@@ -103,14 +102,14 @@ Model loadTiledModel(String path, int count, int COLS, int ROWS)
     auto const height = 1.0 / float(ROWS);
 
     Action action;
-    addTexture(action, path, Rect2f(col * width, row * height, width, height));
+    addTexture(loadTexture, action, path, Rect2f(col * width, row * height, width, height));
     m.actions.push_back(action);
   }
 
   return m;
 }
 
-Model loadModel(String path)
+Model loadModel(String path, TextureLoader const& loadTexture)
 {
   try
   {
@@ -122,7 +121,7 @@ Model loadModel(String path)
         path = "res/sprites/rect.model";
       }
 
-      return loadAnimatedModel(path);
+      return loadAnimatedModel(loadTexture, path);
     }
     else if(endsWith(path, ".tiles"))
     {
@@ -134,7 +133,7 @@ Model loadModel(String path)
         pngPath = "res/tiles/default.png";
       }
 
-      return loadTiledModel(pngPath, 64, 8, 8);
+      return loadTiledModel(loadTexture, pngPath, 64, 8, 8);
     }
     else
     {
@@ -147,3 +146,22 @@ Model loadModel(String path)
   }
 }
 
+
+int getFrameTexture(Model const& model, int actionIdx, float ratio)
+{
+  if(model.actions.empty())
+    throw Error("model has no actions");
+
+  if(actionIdx < 0 || actionIdx >= (int)model.actions.size())
+    throw Error("invalid action index");
+
+  auto const& action = model.actions[actionIdx];
+
+  if(action.textures.empty())
+    throw Error("action has no textures");
+
+  auto const N = (int)action.textures.size();
+  auto const idx = ::clamp<int>(ratio * N, 0, N - 1);
+
+  return action.textures[idx];
+}
@@ -6,7 +6,9 @@
 
 #pragma once
 
+#include "base/geom.h"
 #include "base/string.h"
+#include <functional>
 #include <vector>
 using namespace std;
 
@@ -20,5 +22,12 @@ struct Model
   vector<Action> actions;
 };
 
-Model loadModel(String path);
+// Loads the frame 'rect' (in [0;1]) of the picture at 'path',
+// and returns a backend-specific texture index.
+typedef function<int(String path, Rect2f rect)> TextureLoader;
+
+Model loadModel(String path, TextureLoader const& loadTexture);
+
+// texture index of the frame at 'ratio' (in [0;1]) of the action
+int getFrameTexture(Model const& model, int actionIdx, float ratio);
 
@@ -4,10 +4,20 @@
 #include "png.h"
 #include <cstring> // memcpy
 #include <map>
+#include <memory> // shared_ptr
+#include <mutex>
 
 namespace
 {
-map<string, Picture> g_pictureCache;
+// pictures can be loaded from several threads at once
+struct CachedPicture
+{
+  once_flag decoded;
+  Picture pic;
+};
+
+mutex g_pictureCacheMutex;
+map<string, shared_ptr<CachedPicture>> g_pictureCache;
 
 Picture loadPng(string path)
 {
@@ -22,10 +32,23 @@ Picture loadPng(string path)
 
 Picture* getPicture(string path)
 {
-  if(g_pictureCache.find(path) == g_pictureCache.end())
-    g_pictureCache[path] = loadPng(path);
+  shared_ptr<CachedPicture> entry;
+
+  {
+    lock_guard<mutex> lock(g_pictureCacheMutex);
+    auto& slot = g_pictureCache[path];
+
+    if(!slot)
+      slot = make_shared<CachedPicture>();
+
+    entry = slot;
+  }
+
+  // decode outside of the lock: other files can be decoded meanwhile,
+  // and the requests for the same file wait for the first one.
+  call_once(entry->decoded, [&] () { entry->pic = loadPng(path); });
 
-  return &g_pictureCache.at(path);
+  return &entry->pic;
 }
 }
 
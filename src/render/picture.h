@@ -4,6 +4,7 @@
 #include <vector>
 
 #include "base/geom.h"
+#include "base/string.h"
 
 struct PictureView
 {
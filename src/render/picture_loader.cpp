@@ -0,0 +1,106 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+#include "picture_loader.h"
+
+using namespace std;
+
+PictureLoader::PictureLoader(int workerCount)
+{
+  for(int i = 0; i < workerCount; ++i)
+    m_workers.push_back(thread([this] () { workerMain(); }));
+}
+
+PictureLoader::~PictureLoader()
+{
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_quit = true;
+    m_requests.clear();
+  }
+
+  m_wakeUp.notify_all();
+
+  for(auto& worker : m_workers)
+    worker.join();
+}
+
+void PictureLoader::request(int id, String path, Rect2f rect)
+{
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_requests.push_back({ id, string(path.data, path.len), rect });
+    ++m_pendingCount;
+  }
+
+  m_wakeUp.notify_one();
+}
+
+bool PictureLoader::poll(int& id, Picture& pic)
+{
+  if(m_workers.empty())
+  {
+    Request req;
+
+    {
+      lock_guard<mutex> lock(m_mutex);
+
+      if(m_requests.empty())
+        return false;
+
+      req = move(m_requests.front());
+      m_requests.pop_front();
+      --m_pendingCount;
+    }
+
+    id = req.id;
+    pic = loadPicture(req.path, req.rect);
+    return true;
+  }
+
+  lock_guard<mutex> lock(m_mutex);
+
+  if(m_results.empty())
+    return false;
+
+  id = m_results.front().id;
+  pic = move(m_results.front().pic);
+  m_results.pop_front();
+  --m_pendingCount;
+
+  return true;
+}
+
+int PictureLoader::pendingCount() const
+{
+  lock_guard<mutex> lock(m_mutex);
+  return m_pendingCount;
+}
+
+void PictureLoader::workerMain()
+{
+  while(true)
+  {
+    Request req;
+
+    {
+      unique_lock<mutex> lock(m_mutex);
+      m_wakeUp.wait(lock, [&] () { return m_quit || !m_requests.empty(); });
+
+      if(m_quit)
+        return;
+
+      req = move(m_requests.front());
+      m_requests.pop_front();
+    }
+
+    // 'loadPicture' never throws: it falls back on a generated picture
+    Result result { req.id, loadPicture(req.path, req.rect) };
+
+    lock_guard<mutex> lock(m_mutex);
+    m_results.push_back(move(result));
+  }
+}
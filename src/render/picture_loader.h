@@ -0,0 +1,67 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+// Decodes pictures on worker threads, so loading a model never blocks
+// the frame. The caller polls for the decoded pictures, and uploads them
+// at its own pace.
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/geom.h"
+#include "base/string.h"
+#include "picture.h"
+
+struct PictureLoader
+{
+  // With zero workers, the pictures are decoded by 'poll' itself,
+  // one per call (e.g when threads aren't available).
+  explicit PictureLoader(int workerCount);
+
+  // the pending requests are dropped
+  ~PictureLoader();
+
+  // queues the decoding of 'path', cropped to 'rect' (see 'loadPicture').
+  // 'id' is returned along with the picture.
+  void request(int id, String path, Rect2f rect);
+
+  // Never blocks. Returns false if no picture is ready yet.
+  bool poll(int& id, Picture& pic);
+
+  // requested, but not returned by 'poll' yet
+  int pendingCount() const;
+
+private:
+  struct Request
+  {
+    int id;
+    std::string path;
+    Rect2f rect;
+  };
+
+  struct Result
+  {
+    int id;
+    Picture pic;
+  };
+
+  void workerMain();
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_wakeUp;
+  std::deque<Request> m_requests; // FIFO
+  std::deque<Result> m_results; // FIFO
+  int m_pendingCount = 0;
+  bool m_quit = false;
+
+  std::vector<std::thread> m_workers;
+};
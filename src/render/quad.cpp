@@ -0,0 +1,289 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+#include "quad.h"
+
+#include <algorithm> // min, max
+#include <cmath> // cos, sin
+
+#include "base/error.h"
+#include "base/my_algorithm.h" // radixSort
+#include "matrix3.h"
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+using namespace std;
+
+void placeQuad(Quad& q, Rect2f where, float angle, Camera cam)
+{
+  if(where.size.width < 0)
+    where.pos.x -= where.size.width;
+
+  if(where.size.height < 0)
+    where.pos.y -= where.size.height;
+
+  q.size = where.size;
+  q.pos = where.pos - cam.pos;
+  q.angle = angle;
+
+  // rotating around the camera is the same as rotating the quad origin,
+  // then the quad itself around its origin.
+  if(cam.angle != 0)
+  {
+    auto const ca = cos(-cam.angle);
+    auto const sa = sin(-cam.angle);
+    q.pos = Vector2f(ca * q.pos.x - sa * q.pos.y, sa * q.pos.x + ca * q.pos.y);
+    q.angle -= cam.angle;
+  }
+}
+
+bool isVisible(Quad const& q)
+{
+  // the screen is [-1;1] after the 0.125 scaling of 'getCorners'
+  auto const halfScreen = 8.0f;
+
+  // offsets of the 3 other corners, relative to 'q.pos'
+  auto const w = q.size.width;
+  auto const h = q.size.height;
+  auto x1 = w, y1 = 0.0f;
+  auto x2 = 0.0f, y2 = h;
+
+  if(q.angle != 0)
+  {
+    auto const ca = cos(q.angle);
+    auto const sa = sin(q.angle);
+    x1 = ca * w;
+    y1 = sa * w;
+    x2 = -sa * h;
+    y2 = ca * h;
+  }
+
+  auto const x3 = x1 + x2;
+  auto const y3 = y1 + y2;
+
+  auto const minX = q.pos.x + min({ 0.0f, x1, x2, x3 });
+  auto const maxX = q.pos.x + max({ 0.0f, x1, x2, x3 });
+  auto const minY = q.pos.y + min({ 0.0f, y1, y2, y3 });
+  auto const maxY = q.pos.y + max({ 0.0f, y1, y2, y3 });
+
+  return maxX >= -halfScreen && minX <= halfScreen && maxY >= -halfScreen && minY <= halfScreen;
+}
+
+void getCorners(Quad const& q, Vector2f corners[4])
+{
+  auto mat = scale(Vector2f(q.size.width, q.size.height));
+  mat = rotate(q.angle) * mat;
+  mat = translate(q.pos) * mat;
+
+  auto shrink = scale(0.125 * Vector2f(1, 1));
+  mat = shrink * mat;
+
+  auto const m0x = 0;
+  auto const m0y = 0;
+  auto const m1x = 1;
+  auto const m1y = 1;
+
+  corners[0].x = mat[0][0] * m0x + mat[0][1] * m0y + mat[0][2];
+  corners[0].y = mat[1][0] * m0x + mat[1][1] * m0y + mat[1][2];
+
+  corners[1].x = mat[0][0] * m0x + mat[0][1] * m1y + mat[0][2];
+  corners[1].y = mat[1][0] * m0x + mat[1][1] * m1y + mat[1][2];
+
+  corners[2].x = mat[0][0] * m1x + mat[0][1] * m1y + mat[0][2];
+  corners[2].y = mat[1][0] * m1x + mat[1][1] * m1y + mat[1][2];
+
+  corners[3].x = mat[0][0] * m1x + mat[0][1] * m0y + mat[0][2];
+  corners[3].y = mat[1][0] * m1x + mat[1][1] * m0y + mat[1][2];
+}
+
+void QuadBatch::assign(Span<const Quad> quads)
+{
+  auto const n = quads.len;
+
+  x.resize(n);
+  y.resize(n);
+  width.resize(n);
+  height.resize(n);
+  cosAngle.resize(n);
+  sinAngle.resize(n);
+
+  for(int i = 0; i < n; ++i)
+  {
+    auto const& q = quads[i];
+    x[i] = q.pos.x;
+    y[i] = q.pos.y;
+    width[i] = q.size.width;
+    height[i] = q.size.height;
+
+    // most quads aren't rotated
+    cosAngle[i] = q.angle == 0 ? 1 : cos(q.angle);
+    sinAngle[i] = q.angle == 0 ? 0 : sin(q.angle);
+  }
+}
+
+static_assert(sizeof(Vector2f) == 2 * sizeof(float), "corners are written as float pairs");
+
+void computeCorners(QuadBatch const& batch, Span<Vector2f> corners)
+{
+  auto const n = batch.size();
+  auto const shrink = 0.125f;
+
+  if(corners.len < n * 4)
+    throw Error("computeCorners: output is too small");
+
+  auto out = reinterpret_cast<float*>(corners.data);
+
+  int i = 0;
+
+#if defined(__SSE__)
+  auto const k = _mm_set1_ps(shrink);
+
+  for(; i + 4 <= n; i += 4, out += 32)
+  {
+    auto const x = _mm_mul_ps(_mm_loadu_ps(&batch.x[i]), k);
+    auto const y = _mm_mul_ps(_mm_loadu_ps(&batch.y[i]), k);
+    auto const w = _mm_mul_ps(_mm_loadu_ps(&batch.width[i]), k);
+    auto const h = _mm_mul_ps(_mm_loadu_ps(&batch.height[i]), k);
+    auto const c = _mm_loadu_ps(&batch.cosAngle[i]);
+    auto const s = _mm_loadu_ps(&batch.sinAngle[i]);
+
+    // the rotated edges of the quads
+    auto const ex = _mm_mul_ps(c, w);
+    auto const ey = _mm_mul_ps(s, w);
+    auto const fx = _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(s, h));
+    auto const fy = _mm_mul_ps(c, h);
+
+    // corner k, of the 4 quads: (xk, yk)
+    auto const x1 = _mm_add_ps(x, fx);
+    auto const y1 = _mm_add_ps(y, fy);
+    auto const x2 = _mm_add_ps(x1, ex);
+    auto const y2 = _mm_add_ps(y1, ey);
+    auto const x3 = _mm_add_ps(x, ex);
+    auto const y3 = _mm_add_ps(y, ey);
+
+    // transpose to (x0, y0, x1, y1, x2, y2, x3, y3) for each quad
+    auto const a0 = _mm_unpacklo_ps(x, y);
+    auto const a1 = _mm_unpackhi_ps(x, y);
+    auto const b0 = _mm_unpacklo_ps(x1, y1);
+    auto const b1 = _mm_unpackhi_ps(x1, y1);
+    auto const c0 = _mm_unpacklo_ps(x2, y2);
+    auto const c1 = _mm_unpackhi_ps(x2, y2);
+    auto const d0 = _mm_unpacklo_ps(x3, y3);
+    auto const d1 = _mm_unpackhi_ps(x3, y3);
+
+    _mm_storeu_ps(out + 0, _mm_movelh_ps(a0, b0));
+    _mm_storeu_ps(out + 4, _mm_movelh_ps(c0, d0));
+    _mm_storeu_ps(out + 8, _mm_movehl_ps(b0, a0));
+    _mm_storeu_ps(out + 12, _mm_movehl_ps(d0, c0));
+    _mm_storeu_ps(out + 16, _mm_movelh_ps(a1, b1));
+    _mm_storeu_ps(out + 20, _mm_movelh_ps(c1, d1));
+    _mm_storeu_ps(out + 24, _mm_movehl_ps(b1, a1));
+    _mm_storeu_ps(out + 28, _mm_movehl_ps(d1, c1));
+  }
+
+#elif defined(__ARM_NEON)
+  auto const k = vdupq_n_f32(shrink);
+
+  for(; i + 4 <= n; i += 4, out += 32)
+  {
+    auto const x = vmulq_f32(vld1q_f32(&batch.x[i]), k);
+    auto const y = vmulq_f32(vld1q_f32(&batch.y[i]), k);
+    auto const w = vmulq_f32(vld1q_f32(&batch.width[i]), k);
+    auto const h = vmulq_f32(vld1q_f32(&batch.height[i]), k);
+    auto const c = vld1q_f32(&batch.cosAngle[i]);
+    auto const s = vld1q_f32(&batch.sinAngle[i]);
+
+    // the rotated edges of the quads
+    auto const ex = vmulq_f32(c, w);
+    auto const ey = vmulq_f32(s, w);
+    auto const fx = vnegq_f32(vmulq_f32(s, h));
+    auto const fy = vmulq_f32(c, h);
+
+    // corner k, of the 4 quads: (xk, yk)
+    auto const x1 = vaddq_f32(x, fx);
+    auto const y1 = vaddq_f32(y, fy);
+    auto const x2 = vaddq_f32(x1, ex);
+    auto const y2 = vaddq_f32(y1, ey);
+    auto const x3 = vaddq_f32(x, ex);
+    auto const y3 = vaddq_f32(y, ey);
+
+    // transpose to (x0, y0, x1, y1, x2, y2, x3, y3) for each quad
+    auto const a = vzipq_f32(x, y);
+    auto const b = vzipq_f32(x1, y1);
+    auto const cc = vzipq_f32(x2, y2);
+    auto const d = vzipq_f32(x3, y3);
+
+    for(int q = 0; q < 4; ++q)
+    {
+      auto const half = q / 2;
+      auto const hi = q % 2;
+      auto pick =
+        [&] (float32x4x2_t v)
+        {
+          return hi ? vget_high_f32(v.val[half]) : vget_low_f32(v.val[half]);
+        };
+
+      vst1q_f32(out + q * 8 + 0, vcombine_f32(pick(a), pick(b)));
+      vst1q_f32(out + q * 8 + 4, vcombine_f32(pick(cc), pick(d)));
+    }
+  }
+
+#endif
+
+  // scalar version, and remainder of the SIMD loop
+  for(; i < n; ++i, out += 8)
+  {
+    auto const x = batch.x[i] * shrink;
+    auto const y = batch.y[i] * shrink;
+    auto const w = batch.width[i] * shrink;
+    auto const h = batch.height[i] * shrink;
+    auto const c = batch.cosAngle[i];
+    auto const s = batch.sinAngle[i];
+
+    auto const ex = c * w;
+    auto const ey = s * w;
+    auto const fx = -(s * h);
+    auto const fy = c * h;
+
+    out[0] = x;
+    out[1] = y;
+    out[2] = x + fx;
+    out[3] = y + fy;
+    out[4] = x + fx + ex;
+    out[5] = y + fy + ey;
+    out[6] = x + ex;
+    out[7] = y + ey;
+  }
+}
+
+array<float, 3> getQuadLight(float ambientLight, bool blinking, int frameCount)
+{
+  if(blinking && (frameCount / 4) % 2)
+    return { 0.8, 0.4, 0.4 };
+
+  return { ambientLight, ambientLight, ambientLight };
+}
+
+void QuadSorter::sort(Span<const Quad> quads)
+{
+  m_keys.resize(quads.len);
+
+  for(int i = 0; i < quads.len; ++i)
+  {
+    auto const& q = quads[i];
+    auto const zOrder = uint32_t(q.zOrder) ^ 0x80000000u; // signed to unsigned order
+    auto const texture = uint64_t(q.texture & 0xffff); // only used to group quads together
+    m_keys[i] = (uint64_t(zOrder) << 32) | texture;
+  }
+
+  order.resize(quads.len);
+  m_scratch.resize(quads.len);
+  my::radixSort(m_keys, order, m_scratch);
+}
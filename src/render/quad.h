@@ -0,0 +1,79 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+// Textured quads, as drawn by the display backends.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "base/geom.h"
+#include "base/span.h"
+
+struct Camera
+{
+  Vector2f pos = Vector2f(0, 0);
+  float angle = 0;
+};
+
+struct Quad
+{
+  int zOrder;
+  std::array<float, 3> light {};
+  uint32_t texture; // backend-specific
+  Rect2f uv; // region of 'texture'
+
+  // the quad is the unit square, scaled by 'size', rotated by 'angle'
+  // and translated to 'pos' (relative to the camera).
+  Vector2f pos;
+  Size2f size;
+  float angle;
+};
+
+// Sets the geometry of 'q', relative to the camera.
+// 'where' is the bounding rectangle of the unrotated quad; a negative size
+// flips the quad inside this rectangle.
+void placeQuad(Quad& q, Rect2f where, float angle, Camera cam);
+
+// Conservative test against the screen, using the bounding box of the
+// rotated (and maybe flipped) quad, in camera space.
+bool isVisible(Quad const& q);
+
+// Clip space corners, in this order: (0, 0), (0, 1), (1, 1), (1, 0)
+// of the unit square. The screen is [-1;1].
+void getCorners(Quad const& q, Vector2f corners[4]);
+
+// The geometry of a list of quads, as structure-of-arrays.
+struct QuadBatch
+{
+  void assign(Span<const Quad> quads);
+  int size() const { return (int)x.size(); }
+
+  std::vector<float> x, y;
+  std::vector<float> width, height;
+  std::vector<float> cosAngle, sinAngle;
+};
+
+// Same as 'getCorners', for all the quads of 'batch' at once: 'corners'
+// receives 4 corners per quad. Uses SSE or NEON when available.
+void computeCorners(QuadBatch const& batch, Span<Vector2f> corners);
+
+std::array<float, 3> getQuadLight(float ambientLight, bool blinking, int frameCount);
+
+// Draw order: by zOrder, then texture, to group quads together.
+// Quads with the same key keep their submission order.
+struct QuadSorter
+{
+  void sort(Span<const Quad> quads);
+
+  std::vector<int> order; // indices of the quads, in drawing order
+
+private:
+  std::vector<uint64_t> m_keys;
+  std::vector<int> m_scratch;
+};
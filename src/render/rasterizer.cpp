@@ -0,0 +1,218 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+#include "rasterizer.h"
+
+#include <algorithm> // min, max
+#include <cmath> // ceil, floor
+#include <cstring> // memcpy
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+void Framebuffer::resize(Size2i size)
+{
+  dim = size;
+  pixels.resize(size.width * size.height * 4);
+}
+
+void Framebuffer::clear(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+  uint8_t const color[] = { r, g, b, a };
+
+  for(int i = 0; i < (int)pixels.size(); i += 4)
+    memcpy(&pixels[i], color, 4);
+}
+
+namespace
+{
+// restricts [lo;hi] to where 'a + b * x' is in [0;1]
+void restrictSpan(float a, float b, float& lo, float& hi)
+{
+  if(b == 0)
+  {
+    if(a < 0 || a > 1)
+      hi = lo; // empty
+
+    return;
+  }
+
+  auto x0 = -a / b;
+  auto x1 = (1 - a) / b;
+
+  if(x0 > x1)
+    swap(x0, x1);
+
+  lo = max(lo, x0);
+  hi = min(hi, x1);
+}
+
+// dst = src * a + dst * (1 - a), after adding 'offset' to src.
+// Integer division by 255, rounded, bit-exact with the SIMD version.
+inline void blendPixel(uint8_t* dst, uint8_t const* src, int16_t const offset[4])
+{
+  int const alpha = src[3];
+
+  for(int c = 0; c < 4; ++c)
+  {
+    auto const s = min(max(src[c] + offset[c], 0), 255);
+    auto const t = s * alpha + dst[c] * (255 - alpha) + 128;
+    dst[c] = uint8_t((t + (t >> 8)) >> 8);
+  }
+}
+
+#ifdef __SSE2__
+// same as 'blendPixel', on 4 pixels
+inline void blendPixels4(uint8_t* dst, __m128i src, __m128i offset)
+{
+  auto const zero = _mm_setzero_si128();
+  auto const v128 = _mm_set1_epi16(128);
+  auto const v255 = _mm_set1_epi16(255);
+
+  auto const d = _mm_loadu_si128((__m128i*)dst);
+
+  auto blend =
+    [&] (__m128i s, __m128i d)
+    {
+      s = _mm_min_epi16(_mm_max_epi16(_mm_add_epi16(s, offset), zero), v255);
+
+      // broadcast the alpha of each pixel to its 4 channels
+      auto const a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xFF), 0xFF);
+
+      auto t = _mm_add_epi16(_mm_mullo_epi16(s, a), _mm_mullo_epi16(d, _mm_sub_epi16(v255, a)));
+      t = _mm_add_epi16(t, v128);
+      return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+    };
+
+  auto const lo = blend(_mm_unpacklo_epi8(src, zero), _mm_unpacklo_epi8(d, zero));
+  auto const hi = blend(_mm_unpackhi_epi8(src, zero), _mm_unpackhi_epi8(d, zero));
+  _mm_storeu_si128((__m128i*)dst, _mm_packus_epi16(lo, hi));
+}
+
+#endif
+}
+
+void drawTexturedQuad(Framebuffer& fb, Rect2i clip, Vector2f const corners[4], PictureView texture, Rect2f uv, std::array<float, 3> light)
+{
+  // inverse mapping, from pixels to the unit square (s, t)
+  auto const p0 = corners[0];
+  auto const es = corners[3] - corners[0];
+  auto const et = corners[1] - corners[0];
+  auto const det = es.x * et.y - es.y * et.x;
+
+  if(fabs(det) < 1.0e-6f)
+    return;
+
+  auto const dsdx = et.y / det;
+  auto const dsdy = -et.x / det;
+  auto const dtdx = -es.y / det;
+  auto const dtdy = es.x / det;
+
+  // clip against the framebuffer and the bounding box of the quad
+  auto x0 = max(0, clip.pos.x);
+  auto y0 = max(0, clip.pos.y);
+  auto x1 = min(fb.dim.width, clip.pos.x + clip.size.width);
+  auto y1 = min(fb.dim.height, clip.pos.y + clip.size.height);
+
+  {
+    auto minX = p0.x, maxX = p0.x, minY = p0.y, maxY = p0.y;
+
+    for(int i = 1; i < 4; ++i)
+    {
+      minX = min(minX, corners[i].x);
+      maxX = max(maxX, corners[i].x);
+      minY = min(minY, corners[i].y);
+      maxY = max(maxY, corners[i].y);
+    }
+
+    x0 = max(x0, (int)floor(minX));
+    y0 = max(y0, (int)floor(minY));
+    x1 = min(x1, (int)ceil(maxX));
+    y1 = min(y1, (int)ceil(maxY));
+  }
+
+  // texel coordinates, as affine functions of (s, t)
+  auto const texW = texture.dim.width;
+  auto const texH = texture.dim.height;
+  auto const uOrigin = uv.pos.x * texW;
+  auto const vOrigin = uv.pos.y * texH;
+  auto const uScale = uv.size.width * texW;
+  auto const vScale = uv.size.height * texH;
+
+  // what 'fragment.glsl' adds to the texel color
+  int16_t const offset[4] =
+  {
+    int16_t(lround((light[0] + 0.2f) * 255)),
+    int16_t(lround((light[1] + 0.2f) * 255)),
+    int16_t(lround(light[2] * 255)),
+    0,
+  };
+
+#ifdef __SSE2__
+  auto const offset4 = _mm_set_epi16(offset[3], offset[2], offset[1], offset[0], offset[3], offset[2], offset[1], offset[0]);
+#endif
+
+  // texel coordinates are stepped along the spans in 16.16 fixed point
+  auto const ONE = 65536.0f;
+  auto const duFixed = (int)lround(uScale * dsdx * ONE);
+  auto const dvFixed = (int)lround(vScale * dtdx * ONE);
+
+  for(int y = y0; y < y1; ++y)
+  {
+    // (s, t) at the center of the pixel (0, y)
+    auto const dy = y + 0.5f - p0.y;
+    auto const s0 = dsdx * (0.5f - p0.x) + dsdy * dy;
+    auto const t0 = dtdx * (0.5f - p0.x) + dtdy * dy;
+
+    float lo = x0;
+    float hi = x1;
+    restrictSpan(s0, dsdx, lo, hi);
+    restrictSpan(t0, dtdx, lo, hi);
+
+    // half-open, so adjacent quads don't overlap
+    auto const spanBegin = max(x0, (int)ceil(lo));
+    auto const spanEnd = min(x1, (int)ceil(hi));
+
+    if(spanBegin >= spanEnd)
+      continue;
+
+    auto u = (int)lround((uOrigin + uScale * (s0 + dsdx * spanBegin)) * ONE);
+    auto v = (int)lround((vOrigin + vScale * (t0 + dtdx * spanBegin)) * ONE);
+
+    auto texel =
+      [&] ()
+      {
+        // nearest sampling. Clamped, as the span ends can be slightly off.
+        auto const tx = min(max(u >> 16, 0), texW - 1);
+        auto const ty = min(max(v >> 16, 0), texH - 1);
+        u += duFixed;
+        v += dvFixed;
+        return texture.pixels + ty * texture.stride + tx * 4;
+      };
+
+    auto dst = &fb.pixels[(y * fb.dim.width + spanBegin) * 4];
+    int x = spanBegin;
+
+#ifdef __SSE2__
+    for(; x + 4 <= spanEnd; x += 4, dst += 16)
+    {
+      uint32_t src[4];
+
+      for(int k = 0; k < 4; ++k)
+        memcpy(&src[k], texel(), 4);
+
+      blendPixels4(dst, _mm_loadu_si128((__m128i*)src), offset4);
+    }
+
+#endif
+
+    for(; x < spanEnd; ++x, dst += 4)
+      blendPixel(dst, texel(), offset);
+  }
+}
@@ -0,0 +1,35 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+// CPU rasterizer, for the headless display.
+// Mimics the OpenGL pipeline: nearest sampling, the light offset of
+// 'fragment.glsl', then (SRC_ALPHA, ONE_MINUS_SRC_ALPHA) blending.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "base/geom.h"
+#include "picture.h"
+
+// RGBA, top-down rows
+struct Framebuffer
+{
+  Size2i dim;
+  std::vector<uint8_t> pixels;
+
+  void resize(Size2i size);
+  void clear(uint8_t r, uint8_t g, uint8_t b, uint8_t a);
+};
+
+// 'corners' are in framebuffer pixels, in the order of 'getCorners'.
+// 'texture' is RGBA, its stride is in bytes. 'uv' is the region of
+// 'texture' mapped to the quad.
+// Only the pixels whose centers are inside the quad and inside 'clip'
+// are drawn.
+void drawTexturedQuad(Framebuffer& fb, Rect2i clip, Vector2f const corners[4], PictureView texture, Rect2f uv, std::array<float, 3> light);
@@ -0,0 +1,51 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+#include "text_cache.h"
+
+using namespace std;
+
+vector<Quad> const* TextCache::find(Vector2f pos, char const* text)
+{
+  auto i = m_runs.find(makeKey(pos, text));
+
+  if(i == m_runs.end())
+    return nullptr;
+
+  i->second.used = true;
+  return &i->second.glyphs;
+}
+
+void TextCache::add(Vector2f pos, char const* text, Span<const Quad> glyphs)
+{
+  auto& run = m_runs[makeKey(pos, text)];
+  run.glyphs.assign(glyphs.begin(), glyphs.end());
+  run.used = true;
+}
+
+void TextCache::endFrame()
+{
+  for(auto i = m_runs.begin(); i != m_runs.end();)
+  {
+    if(!i->second.used)
+    {
+      i = m_runs.erase(i);
+      continue;
+    }
+
+    i->second.used = false;
+    ++i;
+  }
+}
+
+// the text, then the raw bytes of the position
+string const& TextCache::makeKey(Vector2f pos, char const* text)
+{
+  m_key.assign(text);
+  m_key.push_back(0);
+  m_key.append((char const*)&pos, sizeof pos);
+  return m_key;
+}
@@ -0,0 +1,48 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+// Keeps the glyph quads of the text lines drawn during the last frames,
+// so a line that doesn't change isn't laid out again.
+// Only the layout is cached: the glyphs are still sorted, transformed
+// and streamed with the other quads.
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "base/geom.h"
+#include "base/span.h"
+#include "quad.h"
+
+struct TextCache
+{
+  // the glyphs of 'text' at 'pos', or null if they aren't cached
+  std::vector<Quad> const* find(Vector2f pos, char const* text);
+
+  void add(Vector2f pos, char const* text, Span<const Quad> glyphs);
+
+  // forgets the lines that weren't used since the previous call
+  void endFrame();
+
+  // e.g when the glyph textures change
+  void clear() { m_runs.clear(); }
+
+  int size() const { return (int)m_runs.size(); }
+
+private:
+  std::string const& makeKey(Vector2f pos, char const* text);
+
+  struct Run
+  {
+    std::vector<Quad> glyphs;
+    bool used;
+  };
+
+  std::unordered_map<std::string, Run> m_runs;
+  std::string m_key; // reused, to avoid allocations
+};
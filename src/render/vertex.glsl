@@ -3,15 +3,22 @@
 // Input vertex data, different for all executions of this shader
 in vec2 vertexPos_model;
 in vec2 vertexUV;
+in vec3 vertexLightOffset;
+
+// view transform, for the static meshes (identity for the batched quads)
+uniform vec2 positionOffset;
+uniform float positionScale;
 
 // Output data; will be interpolated for each fragment
 out vec2 UV;
 out vec4 vertexPos_world;
+out vec4 vertexLight;
 
 void main()
 {
-  gl_Position = vec4(vertexPos_model, 0, 1);
+  gl_Position = vec4((vertexPos_model + positionOffset) * positionScale, 0, 1);
   UV = vertexUV;
   vertexPos_world = gl_Position;
+  vertexLight = vec4(vertexLightOffset, 0);
 }
 // vim: syntax=glsl
@@ -0,0 +1,31 @@
+#version 300 es
+
+// Corner of the unit quad, shared by all instances
+in vec2 corner;
+
+// Per-instance data
+in vec2 instancePos; // quad origin, relative to the camera
+in vec2 instanceSize;
+in float instanceAngle;
+in vec4 instanceUV; // (u0, v0, u1, v1)
+in vec3 instanceLight;
+
+// Output data; will be interpolated for each fragment
+out vec2 UV;
+out vec4 vertexPos_world;
+out vec4 vertexLight;
+
+void main()
+{
+  vec2 pos = corner * instanceSize;
+
+  float c = cos(instanceAngle);
+  float s = sin(instanceAngle);
+  pos = vec2(c * pos.x - s * pos.y, s * pos.x + c * pos.y);
+
+  gl_Position = vec4((instancePos + pos) * 0.125, 0, 1);
+  UV = mix(instanceUV.xy, instanceUV.zw, corner);
+  vertexPos_world = gl_Position;
+  vertexLight = vec4(instanceLight, 0);
+}
+// vim: syntax=glsl
@@ -0,0 +1,58 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+#include "render/atlas.h"
+#include "tests.h"
+#include <vector>
+using namespace std;
+
+static
+bool rectsOverlap(Rect2i a, Rect2i b)
+{
+  if(a.pos.x + a.size.width <= b.pos.x || b.pos.x + b.size.width <= a.pos.x)
+    return false;
+
+  if(a.pos.y + a.size.height <= b.pos.y || b.pos.y + b.size.height <= a.pos.y)
+    return false;
+
+  return true;
+}
+
+unittest("Atlas: slots don't overlap, and stay inside their page")
+{
+  auto const pageSize = Size2i(256, 256);
+  Atlas atlas(pageSize);
+
+  vector<Atlas::Slot> slots;
+
+  for(int i = 0; i < 300; ++i)
+  {
+    auto const size = Size2i(8 + (i * 7) % 40, 8 + (i * 13) % 24);
+    auto slot = atlas.allocate(size);
+
+    assertEquals(size.width, slot.rect.size.width);
+    assertEquals(size.height, slot.rect.size.height);
+    assertTrue(slot.rect.pos.x >= 0 && slot.rect.pos.x + size.width <= pageSize.width);
+    assertTrue(slot.rect.pos.y >= 0 && slot.rect.pos.y + size.height <= pageSize.height);
+
+    for(auto& other : slots)
+      assertTrue(other.page != slot.page || !rectsOverlap(other.rect, slot.rect));
+
+    slots.push_back(slot);
+  }
+
+  assertTrue(atlas.pageCount() > 1);
+}
+
+unittest("Atlas: a tileset fits in a single page")
+{
+  Atlas atlas(Size2i(1024, 1024));
+
+  for(int i = 0; i < 64; ++i)
+    atlas.allocate(Size2i(18, 18));
+
+  assertEquals(1, atlas.pageCount());
+}
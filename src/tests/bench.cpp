@@ -0,0 +1,70 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+// Micro-benchmark framework: runner and entry point
+
+#include "bench.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring> // strstr
+
+static Benchmark* g_first;
+static Benchmark* g_last;
+
+BenchmarkRegistration registerBenchmark(Benchmark& benchmark)
+{
+  // keep declaration order
+  if(g_last)
+    g_last->next = &benchmark;
+  else
+    g_first = &benchmark;
+
+  g_last = &benchmark;
+
+  return {};
+}
+
+static
+void runBenchmark(Benchmark const& benchmark)
+{
+  using namespace std::chrono;
+
+  auto const MIN_DURATION = milliseconds(500);
+
+  // warm-up
+  benchmark.func();
+
+  int runs = 0;
+  auto const start = steady_clock::now();
+  auto elapsed = steady_clock::duration(0);
+
+  while(elapsed < MIN_DURATION)
+  {
+    benchmark.func();
+    ++runs;
+    elapsed = steady_clock::now() - start;
+  }
+
+  auto const meanUs = duration_cast<nanoseconds>(elapsed).count() / 1000.0 / runs;
+  printf("%-60s %12.3f us\n", benchmark.name, meanUs);
+  fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+  char const* filter = "";
+
+  if(argc == 2)
+    filter = argv[1];
+
+  for(auto benchmark = g_first; benchmark; benchmark = benchmark->next)
+  {
+    if(strstr(benchmark->name, filter))
+      runBenchmark(*benchmark);
+  }
+
+  return 0;
+}
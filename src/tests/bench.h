@@ -0,0 +1,43 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+// User-code API
+
+// The body of a benchmark is run repeatedly, and its mean duration is reported.
+#define benchmark(name) \
+  benchmarkWithCounter(__COUNTER__, name)
+
+// Prevents the compiler from optimizing away a computed value.
+template<typename T>
+void keep(T const& value)
+{
+  asm volatile ("" : : "g" (&value) : "memory");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// implementation details
+
+struct Benchmark
+{
+  void (* func)();
+  const char* name;
+  Benchmark* next = nullptr;
+};
+
+#define benchmarkWithCounter(counter, name) \
+  benchmark2(counter, name)
+
+#define benchmark2(counter, name) \
+  static void g_myBenchmark ## counter(); \
+  static Benchmark g_myBenchmarkInfo ## counter = { &g_myBenchmark ## counter, name }; \
+  static auto g_registration ## counter = registerBenchmark(g_myBenchmarkInfo ## counter); \
+  static void g_myBenchmark ## counter()
+
+struct BenchmarkRegistration {};
+BenchmarkRegistration registerBenchmark(Benchmark& benchmark);
@@ -0,0 +1,159 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+#include "bench.h"
+#include "gameplay/body.h"
+#include "gameplay/physics.h"
+#include <memory>
+#include <vector>
+
+namespace
+{
+bool isSolid(IntBox rect)
+{
+  return rect.pos.y < 0 || rect.pos.x < 0;
+}
+
+// A room full of static stuff (spikes, ladders, detectors ...),
+// with a few moving bodies, and optionally some moving platforms.
+struct World
+{
+  World(int staticCount, int moverCount, int pusherCount = 0, int threadCount = 1) : bodies(staticCount + moverCount + pusherCount)
+  {
+    physics = createPhysics(threadCount);
+    physics->setEdifice(&isSolid);
+
+    for(int i = 0; i < staticCount; ++i)
+    {
+      auto& body = bodies[i];
+      body.pos = Vector((i * 7) % 128, 1 + (i * 3) % 48);
+      body.solid = i % 2;
+      body.collisionGroup = 4;
+      body.collidesWith = 1;
+      physics->addBody(&body);
+    }
+
+    for(int i = staticCount; i < staticCount + moverCount; ++i)
+    {
+      auto& body = bodies[i];
+      body.pos = Vector((i * 5) % 128, 20);
+      body.size = Size(0.6, 1.8);
+      movers.push_back(&body);
+      physics->addBody(&body);
+    }
+
+    for(int i = staticCount + moverCount; i < (int)bodies.size(); ++i)
+    {
+      auto& body = bodies[i];
+      body.pos = Vector((i * 11) % 128, 60 + (i % 4) * 4);
+      body.size = Size(2, 1);
+      body.solid = true;
+      body.pusher = true;
+      pushers.push_back(&body);
+      physics->addBody(&body);
+    }
+  }
+
+  void tick()
+  {
+    for(auto mover : movers)
+    {
+      physics->moveBody(mover, Vector(dir * 0.05, 0));
+      physics->moveBody(mover, Vector(0, -0.05));
+    }
+
+    for(auto pusher : pushers)
+      physics->moveBody(pusher, Vector(0, dir * 0.06));
+
+    physics->checkForOverlaps();
+
+    if(++ticks % 200 == 0)
+      dir = -dir;
+  }
+
+  unique_ptr<IPhysics> physics;
+  vector<Body> bodies;
+  vector<Body*> movers;
+  vector<Body*> pushers;
+  float dir = 1;
+  int ticks = 0;
+};
+}
+
+benchmark("Physics: 1000 boxes, rounded at each access")
+{
+  static World world(1000, 0);
+
+  for(auto& body : world.bodies)
+    keep(roundBox(body.getFBox()));
+}
+
+benchmark("Physics: 1000 boxes, cached")
+{
+  static World world(1000, 0);
+
+  for(auto& body : world.bodies)
+    keep(body.getBox());
+}
+
+benchmark("Physics: one tick, 300 static bodies, 20 movers")
+{
+  static World world(300, 20);
+  world.tick();
+}
+
+benchmark("Physics: one tick, 3000 static bodies, 20 movers")
+{
+  static World world(3000, 20);
+  world.tick();
+}
+
+benchmark("Physics: one tick, 3000 static bodies, 20 movers, 50 platforms")
+{
+  static World world(3000, 20, 50);
+  world.tick();
+}
+
+benchmark("Physics: all bodies in an 8x8 area, 3000 static bodies")
+{
+  static World world(3000, 0);
+
+  int count = 0;
+  auto onBody = [&] (Body*) { ++count; };
+  world.physics->forEachBodyInBox(IntBox(60 * PRECISION, 20 * PRECISION, 8 * PRECISION, 8 * PRECISION), -1, onBody);
+  keep(count);
+}
+
+benchmark("Physics: 20 raycasts, 3000 static bodies, solidity map")
+{
+  struct RaycastWorld : World
+  {
+    RaycastWorld() : World(3000, 20), map(Size2i(128, 64))
+    {
+      for(int x = 0; x < map.size.width; ++x)
+        map.set(x, 0);
+
+      physics->setEdifice(nullptr);
+      physics->setSolidityMap(&map);
+    }
+
+    SolidityMap map;
+  };
+
+  static RaycastWorld world;
+
+  for(auto mover : world.movers)
+  {
+    auto const target = mover->pos + Vector(30, 10);
+    keep(world.physics->raycast(mover->pos, target, -1, mover).distance);
+  }
+}
+
+benchmark("Physics: one tick, 3000 static bodies, 20 movers, 4 threads")
+{
+  static World world(3000, 20, 0, 4);
+  world.tick();
+}
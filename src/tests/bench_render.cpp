@@ -0,0 +1,257 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+#include "bench.h"
+#include "render/quad.h"
+#include "render/rasterizer.h"
+#include "render/text_cache.h"
+#include <cmath>
+#include <cstdio> // snprintf
+#include <cstring> // strlen
+#include <vector>
+
+namespace
+{
+// a 512x512 framebuffer, and a 16x16 half-transparent sprite
+struct Canvas
+{
+  Canvas() : texels(16 * 16 * 4)
+  {
+    fb.resize(Size2i(512, 512));
+
+    for(int i = 0; i < (int)texels.size(); ++i)
+      texels[i] = (i * 37) % 256;
+  }
+
+  void drawSprite(Vector2f pos, float size, float angle)
+  {
+    auto const ca = cos(angle) * size;
+    auto const sa = sin(angle) * size;
+    Vector2f const corners[] =
+    {
+      pos,
+      pos + Vector2f(-sa, ca),
+      pos + Vector2f(ca - sa, sa + ca),
+      pos + Vector2f(ca, sa),
+    };
+
+    PictureView tex { Size2i(16, 16), 16 * 4, texels.data() };
+    drawTexturedQuad(fb, Rect2i(0, 0, 512, 512), corners, tex, Rect2f(0, 0, 1, 1), { 0, 0, 0 });
+  }
+
+  Framebuffer fb;
+  std::vector<uint8_t> texels;
+};
+}
+
+benchmark("Render: clear a 512x512 framebuffer")
+{
+  static Canvas canvas;
+  canvas.fb.clear(0, 0, 0, 255);
+  keep(canvas.fb.pixels[0]);
+}
+
+benchmark("Render: one full-screen quad")
+{
+  static Canvas canvas;
+  canvas.drawSprite(Vector2f(0, 0), 512, 0);
+  keep(canvas.fb.pixels[0]);
+}
+
+benchmark("Render: 1000 sprites of 32x32 pixels")
+{
+  static Canvas canvas;
+
+  for(int i = 0; i < 1000; ++i)
+    canvas.drawSprite(Vector2f((i * 37) % 480, (i * 91) % 480), 32, 0);
+
+  keep(canvas.fb.pixels[0]);
+}
+
+benchmark("Render: 1000 rotated sprites of 32x32 pixels")
+{
+  static Canvas canvas;
+
+  for(int i = 0; i < 1000; ++i)
+    canvas.drawSprite(Vector2f(16 + (i * 37) % 460, 16 + (i * 91) % 460), 32, i * 0.1f);
+
+  keep(canvas.fb.pixels[0]);
+}
+
+namespace
+{
+// one quad out of 8 is rotated, some are flipped
+std::vector<Quad> makeQuads(int count)
+{
+  std::vector<Quad> quads(count);
+
+  for(int i = 0; i < count; ++i)
+  {
+    auto& q = quads[i];
+    q.pos = Vector2f((i * 37) % 16 - 8, (i * 91) % 16 - 8);
+    q.size = Size2f(i % 5 ? 1 : -1, 1 + (i % 3));
+    q.angle = i % 8 ? 0 : i * 0.1f;
+  }
+
+  return quads;
+}
+
+void cornersOneByOne(std::vector<Quad> const& quads, std::vector<Vector2f>& corners)
+{
+  for(int i = 0; i < (int)quads.size(); ++i)
+    getCorners(quads[i], &corners[i * 4]);
+}
+
+void cornersBatched(std::vector<Quad> const& quads, QuadBatch& batch, std::vector<Vector2f>& corners)
+{
+  batch.assign(quads);
+  computeCorners(batch, corners);
+}
+
+template<int Count>
+struct Quads
+{
+  std::vector<Quad> quads = makeQuads(Count);
+  std::vector<Vector2f> corners = std::vector<Vector2f>(Count * 4);
+  QuadBatch batch;
+};
+}
+
+benchmark("Render: corners of 1k quads, one by one")
+{
+  static Quads<1000> q;
+  cornersOneByOne(q.quads, q.corners);
+  keep(q.corners[0]);
+}
+
+benchmark("Render: corners of 1k quads, batched")
+{
+  static Quads<1000> q;
+  cornersBatched(q.quads, q.batch, q.corners);
+  keep(q.corners[0]);
+}
+
+benchmark("Render: corners of 10k quads, one by one")
+{
+  static Quads<10000> q;
+  cornersOneByOne(q.quads, q.corners);
+  keep(q.corners[0]);
+}
+
+benchmark("Render: corners of 10k quads, batched")
+{
+  static Quads<10000> q;
+  cornersBatched(q.quads, q.batch, q.corners);
+  keep(q.corners[0]);
+}
+
+benchmark("Render: corners of 100k quads, one by one")
+{
+  static Quads<100000> q;
+  cornersOneByOne(q.quads, q.corners);
+  keep(q.corners[0]);
+}
+
+benchmark("Render: corners of 100k quads, batched")
+{
+  static Quads<100000> q;
+  cornersBatched(q.quads, q.batch, q.corners);
+  keep(q.corners[0]);
+}
+
+namespace
+{
+// The stats overlay of the app: a few formatted lines, drawn each frame
+// at the same position, laid out like the display backends do.
+struct Overlay
+{
+  Overlay()
+  {
+    // a 16x16 grid of glyphs
+    for(int c = 0; c < 256; ++c)
+      glyphUv[c] = Rect2f((c % 16) / 16.0f, (c / 16) / 16.0f, 1 / 16.0f, 1 / 16.0f);
+  }
+
+  void draw(bool useCache)
+  {
+    quads.clear();
+
+    for(int i = 0; i < 8; ++i)
+    {
+      char txt[256];
+      snprintf(txt, sizeof txt, "%s: %.2f", "Pending textures", i * 10.0f);
+      drawText(Vector2f(0, 4 - i), txt, useCache);
+    }
+
+    cache.endFrame();
+  }
+
+  void drawText(Vector2f pos, char const* text, bool useCache)
+  {
+    auto const light = getQuadLight(0, false, 0);
+
+    if(useCache)
+    {
+      if(auto glyphs = cache.find(pos, text))
+      {
+        for(auto q : *glyphs)
+        {
+          q.light = light;
+          quads.push_back(q);
+        }
+
+        return;
+      }
+    }
+
+    auto const first = (int)quads.size();
+
+    Rect2f rect;
+    rect.size.width = 0.5;
+    rect.size.height = 0.5;
+    rect.pos.x = pos.x - strlen(text) * rect.size.width / 2;
+    rect.pos.y = pos.y;
+
+    for(auto c = text; *c; ++c)
+    {
+      Quad q;
+      q.zOrder = 100;
+      q.texture = 1;
+      q.uv = glyphUv[uint8_t(*c)];
+      placeQuad(q, rect, 0, {});
+
+      if(isVisible(q))
+      {
+        q.light = light;
+        quads.push_back(q);
+      }
+
+      rect.pos.x += rect.size.width;
+    }
+
+    if(useCache)
+      cache.add(pos, text, { quads.data() + first, (int)quads.size() - first });
+  }
+
+  Rect2f glyphUv[256];
+  TextCache cache;
+  std::vector<Quad> quads;
+};
+}
+
+benchmark("Render: 8-line text overlay, laid out")
+{
+  static Overlay overlay;
+  overlay.draw(false);
+  keep(overlay.quads[0]);
+}
+
+benchmark("Render: 8-line text overlay, cached layout")
+{
+  static Overlay overlay;
+  overlay.draw(true);
+  keep(overlay.quads[0]);
+}
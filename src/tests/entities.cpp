@@ -82,9 +82,37 @@ struct NullPhysicsProbe : IPhysicsProbe
       return false;
 
     body->pos += delta;
+    body->intBox = roundBox(body->getFBox());
     return true;
   }
 
+  void teleportBody(Body* body, Vector2f pos)
+  {
+    body->pos = pos;
+    body->intBox = roundBox(body->getFBox());
+  }
+
+  void resizeBody(Body* body, Size2f size)
+  {
+    body->size = size;
+    body->intBox = roundBox(body->getFBox());
+  }
+
+  void setCollisionGroup(Body* body, int collisionGroup)
+  {
+    body->collisionGroup = collisionGroup;
+  }
+
+  void setSolid(Body* body, bool solid)
+  {
+    body->solid = solid;
+  }
+
+  void setCollidesWith(Body* body, int collidesWith)
+  {
+    body->collidesWith = collidesWith;
+  }
+
   bool isSolid(const Body* /*body*/, IntBox rect) const
   {
     return rect.pos.y < 0;
@@ -94,6 +122,15 @@ struct NullPhysicsProbe : IPhysicsProbe
   {
     return nullptr;
   }
+
+  void visitBodiesInBox(IntBox, int, IBodyVisitor&, bool, const Body*) const
+  {
+  }
+
+  RaycastResult raycast(Vector2f, Vector2f, int, const Body*) const
+  {
+    return {};
+  }
 };
 
 float g_AmbientLight = 0;
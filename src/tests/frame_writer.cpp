@@ -0,0 +1,67 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+#include "engine/frame_writer.h"
+#include "tests.h"
+#include <cstdio>
+#include <vector>
+using namespace std;
+
+unittest("FrameWriter: frames are written in order, with rows flipped")
+{
+  auto file = tmpfile();
+  assertTrue(file != nullptr);
+
+  auto const resolution = Size2i(1, 2); // one pixel per row
+  int written = 0;
+
+  {
+    FrameWriter writer(file, resolution, 2);
+
+    for(uint8_t i = 0; i < 10; ++i)
+    {
+      // bottom row first
+      uint8_t pixels[] = { uint8_t(10 * i + 1), 0, 0, 0, uint8_t(10 * i), 0, 0, 0 };
+
+      if(writer.push(pixels))
+        ++written;
+    }
+
+    assertEquals(10 - written, writer.droppedFrames());
+  }
+
+  rewind(file);
+  vector<uint8_t> data(1000);
+  auto const size = (int)fread(data.data(), 1, data.size(), file);
+  fclose(file);
+
+  assertEquals(written * 8, size);
+
+  // frames may have been dropped, but the written ones stay in order
+  int prev = -1;
+
+  for(int k = 0; k < written; ++k)
+  {
+    auto frame = data.data() + k * 8;
+    assertEquals(frame[0] + 1, (int)frame[4]);
+    assertTrue(frame[0] > prev);
+    prev = frame[0];
+  }
+}
+
+unittest("FrameWriter: invalid frame size")
+{
+  auto file = tmpfile();
+  assertTrue(file != nullptr);
+
+  {
+    FrameWriter writer(file, Size2i(2, 2), 1);
+    uint8_t pixels[3] {};
+    assertThrown(writer.push(pixels));
+  }
+
+  fclose(file);
+}
@@ -0,0 +1,60 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+#include "engine/interpolation.h"
+#include "tests.h"
+#include <vector>
+using namespace std;
+
+namespace
+{
+Actor makeActor(MODEL model, float x, float y)
+{
+  Actor r;
+  r.model = model;
+  r.pos = Vector2f(x, y);
+  return r;
+}
+}
+
+unittest("Interpolation: position")
+{
+  auto pos = interpolate(Vector2f(1, 2), Vector2f(2, 4), 0.25);
+  assertEquals(1.25f, pos.x);
+  assertEquals(2.5f, pos.y);
+}
+
+unittest("Interpolation: jumps aren't interpolated")
+{
+  auto pos = interpolate(Vector2f(0, 0), Vector2f(10, 0), 0.5);
+  assertEquals(10.0f, pos.x);
+  assertEquals(0.0f, pos.y);
+}
+
+unittest("Interpolation: actors are matched by model and rank")
+{
+  vector<Actor> prev = { makeActor(1, 0, 0), makeActor(2, 4, 4), makeActor(1, 8, 8) };
+
+  // the first actor of model 1 died, a new actor of model 2 appeared
+  vector<Actor> curr = { makeActor(2, 5, 4), makeActor(1, 9, 8), makeActor(2, 20, 20) };
+
+  vector<Actor> result;
+  ActorInterpolator interpolator;
+  interpolator.interpolate(prev, curr, 0.5, result);
+
+  assertEquals(3, (int)result.size());
+
+  assertEquals(2, result[0].model);
+  assertEquals(4.5f, result[0].pos.x);
+
+  // matched with the first actor of model 1: too far
+  assertEquals(1, result[1].model);
+  assertEquals(9.0f, result[1].pos.x);
+
+  // unmatched
+  assertEquals(2, result[2].model);
+  assertEquals(20.0f, result[2].pos.x);
+}
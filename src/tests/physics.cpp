@@ -6,6 +6,7 @@
  * License, or (at your option) any later version.
  */
 
+#include "base/util.h" // allPairs
 #include "gameplay/body.h"
 #include "gameplay/physics.h"
 #include "tests.h"
@@ -100,3 +101,501 @@ unittest("Physics: left move, blocked by a bigger body")
   assertNearlyEquals(Vector2f(100, 10), fix.mover.pos);
 }
 
+
+unittest("Physics: overlaps are reported in pair order, whatever the distance")
+{
+  auto physics = createPhysics();
+  physics->setEdifice(&isSolid);
+
+  vector<int> reported;
+  Body bodies[40];
+
+  for(int i = 0; i < 40; ++i)
+  {
+    auto& body = bodies[i];
+    body.pos = Vector2f((i % 8) * 3.7 - 10, (i / 8) * 2.9 - 5);
+    body.size = Size2f(1 + (i % 5) * 1.3, 1 + (i % 3) * 2.1);
+
+    // a big one, spanning lots of cells
+    if(i == 7)
+      body.size = Size2f(30, 30);
+
+    body.onCollision = [&reported, &bodies, i] (Body* other) { reported.push_back(i * 100 + int(other - bodies)); };
+    physics->addBody(&body);
+  }
+
+  vector<int> expected;
+
+  for(auto p : allPairs(40))
+  {
+    if(overlaps(bodies[p.first].getBox(), bodies[p.second].getBox()))
+    {
+      expected.push_back(p.second * 100 + p.first);
+      expected.push_back(p.first * 100 + p.second);
+    }
+  }
+
+  physics->checkForOverlaps();
+
+  assertTrue(expected.size() > 0);
+  assertEquals(expected, reported);
+}
+
+unittest("Physics: getBodiesInBox returns the first registered match")
+{
+  Fixture fix;
+  fix.physics->setCollisionGroup(&fix.mover, 0);
+
+  Body a, b, c;
+  a.pos = Vector2f(20, 10);
+  b.pos = Vector2f(5, 5);
+  b.size = Size2f(30, 30);
+  c.pos = Vector2f(20.5, 10);
+  c.solid = true;
+
+  fix.physics->addBody(&a);
+  fix.physics->addBody(&b);
+  fix.physics->addBody(&c);
+
+  auto box = IntBox(20 * PRECISION, 10 * PRECISION, PRECISION, PRECISION);
+  assertTrue(&a == fix.physics->getBodiesInBox(box, -1));
+  assertTrue(&b == fix.physics->getBodiesInBox(box, -1, false, &a));
+  assertTrue(&c == fix.physics->getBodiesInBox(box, -1, true));
+
+  // the last registered body takes the place of the removed one
+  fix.physics->removeBody(&a);
+  assertTrue(&c == fix.physics->getBodiesInBox(box, -1));
+
+  fix.physics->teleportBody(&c, Vector2f(-50, -50));
+  assertTrue(&b == fix.physics->getBodiesInBox(box, -1));
+
+  fix.physics->resizeBody(&b, Size2f(1, 1));
+  assertTrue(nullptr == fix.physics->getBodiesInBox(box, -1));
+}
+
+unittest("Physics: removing the last registered body")
+{
+  Fixture fix;
+  fix.physics->setCollisionGroup(&fix.mover, 0);
+
+  Body a;
+  a.pos = Vector2f(20, 10);
+  fix.physics->addBody(&a);
+
+  auto b = make_unique<Body>();
+  b->pos = Vector2f(40, 10);
+  b->solid = true;
+  fix.physics->addBody(b.get());
+
+  // the entity is deleted right after its removal
+  fix.physics->removeBody(b.get());
+  b.reset();
+
+  auto box = IntBox(40 * PRECISION, 10 * PRECISION, PRECISION, PRECISION);
+  assertTrue(nullptr == fix.physics->getBodiesInBox(box, -1));
+  assertTrue(nullptr == fix.physics->getBodiesInBox(box, -1, true));
+
+  int count = 0;
+  auto onBody = [&] (Body*) { ++count; };
+  fix.physics->forEachBodyInBox(box, -1, onBody);
+  assertEquals(0, count);
+
+  auto boxA = IntBox(20 * PRECISION, 10 * PRECISION, PRECISION, PRECISION);
+  assertTrue(&a == fix.physics->getBodiesInBox(boxA, -1));
+}
+
+unittest("Physics: visitBodiesInBox reports every match, in registration order")
+{
+  auto physics = createPhysics();
+  physics->setEdifice(&isSolid);
+
+  Body bodies[50];
+
+  for(int i = 0; i < 50; ++i)
+  {
+    auto& body = bodies[i];
+    body.pos = Vector2f((i % 10) * 2.3, (i / 10) * 3.1);
+    body.size = Size2f(1 + (i % 4), 1 + (i % 3));
+    body.collisionGroup = i % 7 ? 2 : 4; // a sparse group, and a dense one
+    body.solid = i % 2;
+    physics->addBody(&body);
+  }
+
+  auto check =
+    [&] (IntBox box, int collisionGroup, bool onlySolid, const Body* except)
+    {
+      vector<int> expected;
+
+      for(auto& body : bodies)
+      {
+        if(&body == except || !(body.collisionGroup & collisionGroup) || (onlySolid && !body.solid))
+          continue;
+
+        if(overlaps(body.getBox(), box))
+          expected.push_back(body.physicsIndex);
+      }
+
+      vector<int> reported;
+      auto onBody = [&] (Body* body) { reported.push_back(body->physicsIndex); };
+      physics->forEachBodyInBox(box, collisionGroup, onBody, onlySolid, except);
+
+      assertTrue(expected.size() > 0);
+      assertEquals(expected, reported);
+    };
+
+  auto box = IntBox(3 * PRECISION, 2 * PRECISION, 12 * PRECISION, 8 * PRECISION);
+  check(box, 2, false, nullptr);
+  check(box, 2, true, &bodies[12]);
+  check(box, 4, false, nullptr);
+  check(box, 6, false, &bodies[14]);
+}
+
+unittest("Physics: queries follow collision group and solidity changes")
+{
+  Fixture fix;
+  fix.physics->setCollisionGroup(&fix.mover, 0);
+
+  Body block;
+  block.pos = Vector2f(20, 10);
+  block.collisionGroup = 4;
+  fix.physics->addBody(&block);
+
+  auto box = IntBox(20 * PRECISION, 10 * PRECISION, PRECISION, PRECISION);
+  assertTrue(&block == fix.physics->getBodiesInBox(box, 4));
+  assertTrue(nullptr == fix.physics->getBodiesInBox(box, 4, true));
+  assertTrue(nullptr == fix.physics->getBodiesInBox(box, 8));
+
+  fix.physics->setSolid(&block, true);
+  assertTrue(&block == fix.physics->getBodiesInBox(box, 4, true));
+
+  fix.physics->setCollisionGroup(&block, 8);
+  assertTrue(nullptr == fix.physics->getBodiesInBox(box, 4));
+  assertTrue(&block == fix.physics->getBodiesInBox(box, 8, true));
+
+  fix.physics->setSolid(&block, false);
+  assertTrue(nullptr == fix.physics->getBodiesInBox(box, 8, true));
+}
+
+unittest("Physics: solidity map")
+{
+  auto const size = Size2i(150, 20);
+  SolidityMap map(size);
+
+  for(int y = 0; y < size.height; ++y)
+    for(int x = 0; x < size.width; ++x)
+      if((x * 7 + y * 13) % 11 == 0)
+        map.set(x, y);
+
+  auto expectedIsSolid = [&] (IntBox box)
+    {
+      for(int row = box.pos.y / PRECISION; row <= (box.pos.y + box.size.height) / PRECISION; ++row)
+        for(int col = box.pos.x / PRECISION; col <= (box.pos.x + box.size.width) / PRECISION; ++col)
+          if(col >= 0 && row >= 0 && col < size.width && row < size.height && map.isSolid(col, row))
+            return true;
+
+      return false;
+    };
+
+  for(int i = 0; i < 5000; ++i)
+  {
+    auto const x = (i * 7919) % (160 * PRECISION) - 5 * PRECISION;
+    auto const y = (i * 104729) % (24 * PRECISION) - 2 * PRECISION;
+    auto const w = (i * 31) % (70 * PRECISION);
+    auto const h = (i * 17) % (2 * PRECISION);
+    auto const box = IntBox(x, y, w, h);
+
+    assertEquals(expectedIsSolid(box), map.isSolid(box));
+  }
+}
+
+unittest("Physics: raycast")
+{
+  SolidityMap map(Size2i(64, 32));
+
+  for(int x = 0; x < 64; ++x)
+    map.set(x, 0); // floor
+
+  for(int y = 0; y < 32; ++y)
+    map.set(40, y); // wall
+
+  Fixture fix;
+  fix.physics->setSolidityMap(&map);
+  fix.physics->teleportBody(&fix.mover, Vector2f(20, 5));
+
+  Body crate;
+  crate.pos = Vector2f(30, 4.5);
+  crate.size = Size2f(2, 2);
+  crate.collisionGroup = 4;
+  fix.physics->addBody(&crate);
+
+  // edifice only
+  {
+    auto r = fix.physics->raycast(Vector2f(10, 5.5), Vector2f(50, 5.5), 0);
+    assertTrue(r.hit);
+    assertTrue(nullptr == r.body);
+    assertNearlyEquals(Vector2f(30, 0), Vector2f(r.distance, 0));
+  }
+
+  // the first body is hit
+  {
+    auto r = fix.physics->raycast(Vector2f(10, 5.5), Vector2f(50, 5.5), -1);
+    assertTrue(&fix.mover == r.body);
+    assertNearlyEquals(Vector2f(10, 0), Vector2f(r.distance, 0));
+  }
+
+  // collision group and exception
+  {
+    auto r = fix.physics->raycast(Vector2f(10, 5.5), Vector2f(50, 5.5), 4);
+    assertTrue(&crate == r.body);
+    assertNearlyEquals(Vector2f(20, 0), Vector2f(r.distance, 0));
+
+    r = fix.physics->raycast(Vector2f(10, 5.5), Vector2f(50, 5.5), -1, &fix.mover);
+    assertTrue(&crate == r.body);
+  }
+
+  // downwards, to the floor
+  {
+    auto r = fix.physics->raycast(Vector2f(36, 10), Vector2f(36, -5), -1);
+    assertTrue(r.hit);
+    assertTrue(nullptr == r.body);
+    assertNearlyEquals(Vector2f(9, 0), Vector2f(r.distance, 0));
+  }
+
+  // diagonal, to the wall
+  {
+    auto r = fix.physics->raycast(Vector2f(34, 10), Vector2f(44, 0), -1);
+    assertTrue(r.hit);
+    assertTrue(nullptr == r.body);
+    assertNearlyEquals(Vector2f(6 * sqrt(2), 0), Vector2f(r.distance, 0));
+  }
+
+  // nothing on the way
+  {
+    auto r = fix.physics->raycast(Vector2f(10, 20), Vector2f(39.5, 12), -1);
+    assertTrue(!r.hit);
+  }
+}
+
+unittest("Physics: pushers carry the bodies standing on them")
+{
+  Fixture fix;
+  fix.physics->teleportBody(&fix.mover, Vector2f(10, 2));
+
+  Body lift;
+  lift.pos = Vector2f(9, 1);
+  lift.size = Size2f(3, 1);
+  lift.solid = true;
+  lift.pusher = true;
+  fix.physics->addBody(&lift);
+
+  Body crate;
+  crate.pos = Vector2f(30, 2);
+  fix.physics->addBody(&crate);
+
+  // land on the lift
+  fix.physics->moveBody(&fix.mover, Vector2f(0, -0.1));
+  assertNearlyEquals(Vector2f(10, 2), fix.mover.pos);
+
+  for(int i = 0; i < 10; ++i)
+    fix.physics->moveBody(&lift, Vector2f(0.5, 0.5));
+
+  assertNearlyEquals(Vector2f(14, 1 + 5), lift.pos);
+  assertNearlyEquals(Vector2f(30, 2), crate.pos);
+
+  // still above the lift
+  assertTrue(fix.mover.pos.x >= 15);
+  assertTrue(fix.mover.pos.y >= lift.pos.y + lift.size.height);
+}
+
+unittest("Physics: sleeping bodies still report their overlaps")
+{
+  auto physics = createPhysics();
+  physics->setEdifice(&isSolid);
+
+  vector<int> reported;
+  Body bodies[20];
+
+  for(int i = 0; i < 20; ++i)
+  {
+    auto& body = bodies[i];
+    body.pos = Vector2f((i % 5) * 2.5, (i / 5) * 2.5);
+    body.size = Size2f(3, 3);
+    body.onCollision = [&reported, &bodies, i] (Body* other) { reported.push_back(i * 100 + int(other - bodies)); };
+    physics->addBody(&body);
+  }
+
+  auto expectedOverlaps =
+    [&] ()
+    {
+      vector<int> r;
+
+      for(auto p : allPairs(20))
+      {
+        if(overlaps(bodies[p.first].getBox(), bodies[p.second].getBox()))
+        {
+          r.push_back(p.second * 100 + p.first);
+          r.push_back(p.first * 100 + p.second);
+        }
+      }
+
+      return r;
+    };
+
+  for(int tick = 0; tick < 4; ++tick)
+  {
+    // only one body moves, the other ones fall asleep
+    physics->moveBody(&bodies[7], Vector2f(0.6, 0.7));
+
+    reported.clear();
+    physics->checkForOverlaps();
+    assertEquals(expectedOverlaps(), reported);
+  }
+
+  assertEquals(1, physics->getStats().activeBodies);
+  assertEquals(19, physics->getStats().sleepingBodies);
+
+  // nothing moves
+  reported.clear();
+  physics->checkForOverlaps();
+  assertEquals(expectedOverlaps(), reported);
+  assertEquals(0, physics->getStats().activeBodies);
+
+  // a sleeping body is woken up by a move
+  physics->teleportBody(&bodies[3], Vector2f(5, 5));
+  assertEquals(1, physics->getStats().activeBodies);
+
+  reported.clear();
+  physics->checkForOverlaps();
+  assertEquals(expectedOverlaps(), reported);
+}
+
+unittest("Physics: sleeping bodies follow collision mask changes")
+{
+  auto physics = createPhysics();
+  physics->setEdifice(&isSolid);
+
+  int reported = 0;
+  Body bodies[2];
+
+  for(auto& body : bodies)
+  {
+    body.pos = Vector2f(5, 5);
+    body.size = Size2f(2, 2);
+    body.collidesWith = 0;
+    body.onCollision = [&] (Body*) { ++reported; };
+    physics->addBody(&body);
+  }
+
+  for(int tick = 0; tick < 3; ++tick)
+    physics->checkForOverlaps();
+
+  assertEquals(2, physics->getStats().sleepingBodies);
+  assertEquals(0, reported);
+
+  physics->setCollidesWith(&bodies[0], bodies[1].collisionGroup);
+
+  for(int tick = 0; tick < 3; ++tick)
+  {
+    reported = 0;
+    physics->checkForOverlaps();
+    assertEquals(1, reported);
+  }
+
+  assertEquals(2, physics->getStats().sleepingBodies);
+
+  physics->setCollidesWith(&bodies[0], 0);
+
+  reported = 0;
+  physics->checkForOverlaps();
+  assertEquals(0, reported);
+}
+
+unittest("Physics: the thread count doesn't change the callback order")
+{
+  auto run =
+    [] (int threadCount)
+    {
+      auto physics = createPhysics(threadCount);
+      physics->setEdifice(&isSolid);
+
+      vector<int> reported;
+      vector<Body> bodies(400);
+
+      for(int i = 0; i < (int)bodies.size(); ++i)
+      {
+        auto& body = bodies[i];
+        body.pos = Vector2f((i % 40) * 1.7, (i / 40) * 1.9);
+        body.size = Size2f(1 + (i % 3), 1 + (i % 2));
+
+        // some callbacks move bodies around
+        body.onCollision =
+          [&reported, &bodies, &physics, i] (Body* other)
+          {
+            auto const j = int(other - bodies.data());
+            reported.push_back(i * 1000 + j);
+
+            if((i + j) % 17 == 0)
+              physics->teleportBody(other, other->pos + Vector2f(0.5, 0));
+          };
+
+        physics->addBody(&body);
+      }
+
+      for(int tick = 0; tick < 4; ++tick)
+      {
+        physics->moveBody(&bodies[tick * 50], Vector2f(0.3, 0));
+        physics->checkForOverlaps();
+      }
+
+      return reported;
+    };
+
+  auto const expected = run(1);
+  assertTrue(expected.size() > 0);
+  assertEquals(expected, run(4));
+}
+
+unittest("Physics: the thread count doesn't change the callback order, read-only callbacks")
+{
+  auto run =
+    [] (int threadCount)
+    {
+      auto physics = createPhysics(threadCount);
+      physics->setEdifice(&isSolid);
+
+      vector<int> reported;
+      vector<Body> bodies(600); // more than MIN_PARALLEL_BODIES
+
+      for(int i = 0; i < (int)bodies.size(); ++i)
+      {
+        auto& body = bodies[i];
+        body.pos = Vector2f((i % 30) * 1.3, (i / 30) * 1.4);
+        body.size = Size2f(1 + (i % 3) * 0.5, 1 + (i % 2));
+        body.collisionGroup = 1 << (i % 3);
+        body.collidesWith = (i % 5) ? 0xFFFF : 1;
+
+        body.onCollision =
+          [&reported, &bodies, i] (Body* other)
+          {
+            reported.push_back(i * 1000 + int(other - bodies.data()));
+          };
+
+        physics->addBody(&body);
+      }
+
+      for(int tick = 0; tick < 6; ++tick)
+      {
+        // one body out of 4 keeps moving, the other ones fall asleep
+        for(int i = 0; i < (int)bodies.size(); i += 4)
+          physics->moveBody(&bodies[i], Vector2f(tick % 2 ? -0.3 : 0.3, 0));
+
+        physics->checkForOverlaps();
+      }
+
+      return reported;
+    };
+
+  auto const expected = run(1);
+  assertTrue(expected.size() > 1000);
+  assertEquals(expected, run(4));
+}
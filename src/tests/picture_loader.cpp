@@ -0,0 +1,74 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+#include "render/picture_loader.h"
+#include "tests.h"
+#include <algorithm> // sort
+#include <chrono>
+#include <thread>
+#include <vector>
+using namespace std;
+
+namespace
+{
+// returns the ids, in the order 'poll' returned them
+vector<int> loadAll(PictureLoader& loader, int count)
+{
+  for(int i = 0; i < count; ++i)
+    loader.request(100 + i, "tests/missing.png", Rect2f(0, 0, 1, 1));
+
+  assertEquals(count, loader.pendingCount());
+
+  vector<int> ids;
+
+  for(int attempt = 0; attempt < 5000 && (int)ids.size() < count; ++attempt)
+  {
+    int id;
+    Picture pic;
+
+    if(!loader.poll(id, pic))
+    {
+      this_thread::sleep_for(chrono::milliseconds(1));
+      continue;
+    }
+
+    // missing files are replaced by a generated picture
+    assertEquals(32, pic.dim.width);
+    assertEquals(32, pic.dim.height);
+    ids.push_back(id);
+  }
+
+  assertEquals(0, loader.pendingCount());
+  return ids;
+}
+}
+
+unittest("PictureLoader: decodes on the calling thread, when there are no workers")
+{
+  PictureLoader loader(0);
+
+  int id;
+  Picture pic;
+  assertTrue(!loader.poll(id, pic));
+
+  // one picture per call, in order
+  auto ids = loadAll(loader, 3);
+  assertTrue(ids == vector<int>({ 100, 101, 102 }));
+}
+
+unittest("PictureLoader: decodes on worker threads")
+{
+  PictureLoader loader(2);
+
+  auto ids = loadAll(loader, 10);
+  assertEquals(10, (int)ids.size());
+
+  // the workers can complete out of order
+  sort(ids.begin(), ids.end());
+
+  for(int i = 0; i < 10; ++i)
+    assertEquals(100 + i, ids[i]);
+}
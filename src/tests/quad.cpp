@@ -0,0 +1,69 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+#include "render/quad.h"
+#include "tests.h"
+#include <cmath>
+#include <vector>
+using namespace std;
+
+namespace
+{
+Quad makeQuad(float x, float y, float width, float height, float angle)
+{
+  Quad q {};
+  q.pos = Vector2f(x, y);
+  q.size = Size2f(width, height);
+  q.angle = angle;
+  return q;
+}
+}
+
+unittest("Quad: batch corners match the per-quad transform")
+{
+  // not a multiple of 4: covers the remainder of the SIMD loop
+  vector<Quad> quads;
+
+  for(int i = 0; i < 11; ++i)
+  {
+    auto const flipX = i % 3 == 0 ? -1 : 1;
+    auto const flipY = i % 4 == 0 ? -1 : 1;
+    quads.push_back(makeQuad(i - 5, 2 - i * 0.5f, flipX * (1 + i * 0.25f), flipY * 2.0f, i % 2 ? i * 0.3f : 0));
+  }
+
+  QuadBatch batch;
+  batch.assign(quads);
+
+  vector<Vector2f> corners(quads.size() * 4);
+  computeCorners(batch, corners);
+
+  for(int i = 0; i < (int)quads.size(); ++i)
+  {
+    Vector2f expected[4];
+    getCorners(quads[i], expected);
+
+    for(int k = 0; k < 4; ++k)
+    {
+      assertTrue(fabs(corners[i * 4 + k].x - expected[k].x) < 1.0e-5);
+      assertTrue(fabs(corners[i * 4 + k].y - expected[k].y) < 1.0e-5);
+    }
+  }
+}
+
+unittest("Quad: visibility")
+{
+  // the screen is [-8;8] in camera space
+  assertTrue(isVisible(makeQuad(0, 0, 1, 1, 0)));
+  assertTrue(!isVisible(makeQuad(9, 0, 1, 1, 0)));
+  assertTrue(!isVisible(makeQuad(0, -10, 1, 1, 0)));
+
+  // flipped: extends to the left of its origin
+  assertTrue(isVisible(makeQuad(9, 0, -2, 1, 0)));
+
+  // rotated by 90 degrees: extends to the left of its origin
+  assertTrue(isVisible(makeQuad(9, 0, 1, 2, M_PI / 2)));
+  assertTrue(!isVisible(makeQuad(9, 0, 2, 1, -M_PI / 2)));
+}
@@ -0,0 +1,131 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+#include "render/rasterizer.h"
+#include "tests.h"
+#include <array>
+#include <cstring> // memcmp
+#include <vector>
+using namespace std;
+
+namespace
+{
+typedef array<uint8_t, 4> Color;
+
+Color const Black = { 0, 0, 0, 255 };
+Color const A = { 10, 20, 30, 255 };
+Color const B = { 40, 50, 60, 255 };
+Color const C = { 70, 80, 90, 255 };
+Color const D = { 100, 110, 120, 255 };
+
+// the fragment shader adds 0.2 to red and green: cancel it
+array<float, 3> const NoLight = { -0.2f, -0.2f, 0 };
+
+// 2x2 texture:
+// A B
+// C D
+struct Texture2x2
+{
+  uint8_t pixels[16];
+
+  Texture2x2()
+  {
+    Color const texels[] = { A, B, C, D };
+
+    for(int i = 0; i < 4; ++i)
+      memcpy(pixels + i * 4, texels[i].data(), 4);
+  }
+
+  PictureView view()
+  {
+    return { Size2i(2, 2), 2 * 4, pixels };
+  }
+};
+
+Color getPixel(Framebuffer const& fb, int x, int y)
+{
+  Color r;
+  memcpy(r.data(), &fb.pixels[(y * fb.dim.width + x) * 4], 4);
+  return r;
+}
+
+// draws the 2x2 texture, with the given corners, on a 8x8 black framebuffer
+Framebuffer drawTexture2x2(Vector2f c0, Vector2f c1, Vector2f c2, Vector2f c3)
+{
+  Framebuffer fb;
+  fb.resize(Size2i(8, 8));
+  fb.clear(0, 0, 0, 255);
+
+  Texture2x2 tex;
+  Vector2f const corners[] = { c0, c1, c2, c3 };
+  drawTexturedQuad(fb, Rect2i(0, 0, 8, 8), corners, tex.view(), Rect2f(0, 0, 1, 1), NoLight);
+
+  return fb;
+}
+
+// the 4 texels cover the pixel rect (2, 1)-(6, 5), 2x2 pixels each
+void checkTexture2x2(Framebuffer const& fb, Color topLeft, Color topRight, Color bottomLeft, Color bottomRight)
+{
+  for(int y = 0; y < 8; ++y)
+  {
+    for(int x = 0; x < 8; ++x)
+    {
+      auto expected = Black;
+
+      if(x >= 2 && x < 6 && y >= 1 && y < 5)
+      {
+        auto const right = x >= 4;
+        auto const bottom = y >= 3;
+        expected = bottom ? (right ? bottomRight : bottomLeft) : (right ? topRight : topLeft);
+      }
+
+      assertTrue(getPixel(fb, x, y) == expected);
+    }
+  }
+}
+}
+
+unittest("Rasterizer: axis-aligned quad, nearest sampling")
+{
+  auto fb = drawTexture2x2(Vector2f(2, 1), Vector2f(2, 5), Vector2f(6, 5), Vector2f(6, 1));
+  checkTexture2x2(fb, A, B, C, D);
+}
+
+unittest("Rasterizer: flipped quad")
+{
+  auto fb = drawTexture2x2(Vector2f(6, 1), Vector2f(6, 5), Vector2f(2, 5), Vector2f(2, 1));
+  checkTexture2x2(fb, B, A, D, C);
+}
+
+unittest("Rasterizer: rotated quad")
+{
+  // 's' goes down, 't' goes right
+  auto fb = drawTexture2x2(Vector2f(2, 1), Vector2f(6, 1), Vector2f(6, 5), Vector2f(2, 5));
+  checkTexture2x2(fb, A, C, B, D);
+}
+
+unittest("Rasterizer: light offset and alpha blending")
+{
+  Framebuffer fb;
+  fb.resize(Size2i(8, 1));
+  fb.clear(0, 0, 255, 255);
+
+  uint8_t texel[] = { 200, 100, 50, 128 };
+  PictureView tex { Size2i(1, 1), 4, texel };
+
+  // 5 pixels wide: both the 4-pixel and the single-pixel code paths
+  Vector2f const corners[] = { Vector2f(0, 0), Vector2f(0, 1), Vector2f(5, 1), Vector2f(5, 0) };
+  drawTexturedQuad(fb, Rect2i(0, 0, 8, 1), corners, tex, Rect2f(0, 0, 1, 1), { 0, 0, 0 });
+
+  // color = texel + (0.2, 0.2, 0), clamped, then blended with alpha = 128/255
+  auto const expected = Color { 126, 76, 152, 191 };
+
+  for(int x = 0; x < 5; ++x)
+    assertTrue(getPixel(fb, x, 0) == expected);
+
+  for(int x = 5; x < 8; ++x)
+    assertTrue(getPixel(fb, x, 0) == Color({ 0, 0, 255, 255 }));
+}
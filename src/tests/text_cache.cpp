@@ -0,0 +1,48 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+#include "render/text_cache.h"
+#include "tests.h"
+#include <vector>
+using namespace std;
+
+unittest("TextCache: runs are keyed by text and position")
+{
+  TextCache cache;
+
+  vector<Quad> glyphs(3);
+  glyphs[1].zOrder = 7;
+  cache.add(Vector2f(1, 2), "abc", glyphs);
+
+  assertTrue(cache.find(Vector2f(1, 2), "abd") == nullptr);
+  assertTrue(cache.find(Vector2f(1, 3), "abc") == nullptr);
+
+  auto run = cache.find(Vector2f(1, 2), "abc");
+  assertTrue(run != nullptr);
+  assertEquals(3, (int)run->size());
+  assertEquals(7, (*run)[1].zOrder);
+}
+
+unittest("TextCache: unused runs are evicted")
+{
+  TextCache cache;
+
+  vector<Quad> glyphs(1);
+  cache.add(Vector2f(0, 0), "kept", glyphs);
+  cache.add(Vector2f(0, 0), "dropped", glyphs);
+
+  // frame 1: both used
+  cache.endFrame();
+  assertEquals(2, cache.size());
+
+  // frame 2: only one used
+  assertTrue(cache.find(Vector2f(0, 0), "kept") != nullptr);
+  cache.endFrame();
+
+  assertEquals(1, cache.size());
+  assertTrue(cache.find(Vector2f(0, 0), "dropped") == nullptr);
+  assertTrue(cache.find(Vector2f(0, 0), "kept") != nullptr);
+}
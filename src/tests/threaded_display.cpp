@@ -0,0 +1,187 @@
+// Copyright (C) 2021 - Sebastien Alaiwan
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+
+#include "base/error.h"
+#include "engine/display.h"
+#include "tests.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+Display* createThreadedDisplay(Display* display);
+
+namespace
+{
+// records the calls, and the thread they come from
+struct FakeDisplay : Display
+{
+  FakeDisplay(vector<string>& log_) : log(log_) {}
+
+  void setFullscreen(bool) override {}
+  void setCaption(const char*) override {}
+
+  void loadModel(int id, String path) override
+  {
+    if(string(path.data, path.len) == "missing.model")
+      throw Error("can't load model");
+
+    record("loadModel " + to_string(id));
+  }
+
+  void beginDraw() override { record("beginDraw"); }
+
+  void endDraw() override
+  {
+    record("endDraw");
+
+    while(blockEndDraw)
+      this_thread::yield();
+  }
+
+  void drawActor(Rect2f, float, bool, int modelId, bool, int, float, int) override
+  {
+    record("drawActor " + to_string(modelId));
+  }
+
+  void drawText(Vector2f, char const* text) override { record(string("drawText ") + text); }
+
+  void setTileLayer(int modelId, Matrix2<int> const& tiles) override
+  {
+    record("setTileLayer " + to_string(modelId) + " " + to_string(tiles.get(1, 2)));
+  }
+
+  void drawTileLayer(int zOrder) override { record("drawTileLayer " + to_string(zOrder)); }
+  void setCamera(Vector2f pos) override { record("setCamera " + to_string(int(pos.x))); }
+  void setAmbientLight(float) override {}
+
+  void readPixels(Span<uint8_t> dstRgbPixels) override
+  {
+    record("readPixels");
+
+    for(auto& val : dstRgbPixels)
+      val = 0x42;
+  }
+
+  bool readPixelsDelayed(Span<uint8_t>) override { return false; }
+  bool flushReadback(Span<uint8_t>) override { return false; }
+
+  void detachThread() override {}
+  void attachThread() override {}
+
+  void record(string call)
+  {
+    // all the drawing must happen on the render thread
+    assertTrue(this_thread::get_id() != callerThread);
+
+    lock_guard<mutex> lock(logMutex);
+    log.push_back(call);
+  }
+
+  vector<string>& log;
+  thread::id const callerThread = this_thread::get_id();
+  mutex logMutex;
+  atomic<bool> blockEndDraw { false };
+};
+}
+
+unittest("ThreadedDisplay: calls are replayed on the render thread")
+{
+  vector<string> log;
+
+  {
+    unique_ptr<Display> display(createThreadedDisplay(new FakeDisplay(log)));
+
+    Matrix2<int> tiles(Size2i(2, 3));
+    tiles.set(1, 2, 55);
+
+    display->loadModel(7, "hero.model");
+    display->setTileLayer(7, tiles);
+    display->setCamera(Vector2f(3, 0));
+    display->beginDraw();
+    display->drawActor(Rect2f(0, 0, 1, 1), 0, true, 7, false, 0, 0, 0);
+    display->drawText(Vector2f(0, 0), "hello");
+    display->drawTileLayer(-1);
+    display->endDraw();
+  }
+
+  auto const expected = vector<string>(
+  {
+    "loadModel 7",
+    "setTileLayer 7 55",
+    "setCamera 3",
+    "beginDraw",
+    "drawActor 7",
+    "drawText hello",
+    "drawTileLayer -1",
+    "endDraw",
+  });
+
+  assertTrue(expected == log);
+}
+
+unittest("ThreadedDisplay: frames are dropped instead of waiting for the render thread")
+{
+  vector<string> log;
+
+  {
+    auto fake = new FakeDisplay(log);
+    fake->blockEndDraw = true;
+
+    unique_ptr<Display> display(createThreadedDisplay(fake));
+
+    for(int i = 0; i < 10; ++i)
+    {
+      display->beginDraw();
+      display->drawActor(Rect2f(0, 0, 1, 1), 0, true, i, false, 0, 0, 0);
+      display->endDraw();
+    }
+
+    fake->blockEndDraw = false;
+  }
+
+  int drawnFrames = 0;
+  string lastActor;
+
+  for(auto& call : log)
+  {
+    if(call == "endDraw")
+      ++drawnFrames;
+    else if(call != "beginDraw")
+      lastActor = call;
+  }
+
+  assertTrue(drawnFrames < 10);
+  assertEquals(string("drawActor 9"), lastActor);
+}
+
+unittest("ThreadedDisplay: readPixels waits for the render thread")
+{
+  vector<string> log;
+
+  unique_ptr<Display> display(createThreadedDisplay(new FakeDisplay(log)));
+
+  vector<uint8_t> pixels(16);
+  display->readPixels(pixels);
+
+  assertEquals(0x42, (int)pixels[15]);
+}
+
+unittest("ThreadedDisplay: errors of the render thread are reported to the caller")
+{
+  vector<string> log;
+
+  unique_ptr<Display> display(createThreadedDisplay(new FakeDisplay(log)));
+
+  display->loadModel(1, "missing.model");
+
+  vector<uint8_t> pixels(16);
+  assertThrown(display->readPixels(pixels));
+  assertThrown(display->beginDraw());
+}
@@ -4,9 +4,11 @@
 // published by the Free Software Foundation, either version 3 of the
 // License, or (at your option) any later version.
 
+#include "base/my_algorithm.h"
 #include "base/util.h"
 #include "misc/util.h"
 #include "tests.h"
+#include <algorithm> // stable_sort
 #include <vector>
 using namespace std;
 
@@ -101,3 +103,24 @@ unittest("Util: dirName")
   assertEquals(std::string("Hello/World"), dirName("Hello/World/Goodbye.txt"));
 }
 
+
+unittest("Util: radixSort is stable")
+{
+  vector<uint64_t> keys;
+
+  for(int i = 0; i < 1000; ++i)
+    keys.push_back(((uint64_t)(i * 7919 % 13) << 40) | ((i % 3) << 16) | (i * 31 % 5));
+
+  vector<int> order(keys.size());
+  vector<int> tmp(keys.size());
+  my::radixSort(keys, order, tmp);
+
+  vector<int> expected(keys.size());
+
+  for(int i = 0; i < (int)expected.size(); ++i)
+    expected[i] = i;
+
+  stable_sort(expected.begin(), expected.end(), [&] (int a, int b) { return keys[a] < keys[b]; });
+
+  assertEquals(expected, order);
+}